@@ -10,11 +10,14 @@
 #include "Render/Gpu/Renderer.hpp"
 
 #include "Render/LightProbe.hpp"
+#include "Render/PfmFile.hpp"
 
 #include "App/PythonInterface.hpp"
 
 #include <structmember.h>
 
+#include <string>
+
 namespace App {
     PyTypeObject EngineType;
     PyTypeObject SettingsType;
@@ -41,11 +44,16 @@ namespace App {
         unsigned int width;
         unsigned int height;
         unsigned int samples;
+        float adaptiveThreshold;
+        float timeBudget;
         unsigned int irradianceCacheSamples;
         float irradianceCacheThreshold;
+        PyObject *irradianceCacheFile;
         unsigned int restirIndirectSamples;
         unsigned int restirRadius;
         unsigned int restirCandidates;
+        unsigned int restirSpatialPasses;
+        PyObject *gpuDevice;
         PyObject *renderMethod;
     };
 
@@ -79,10 +87,10 @@ namespace App {
             Py_XDECREF(mListenerObject);
         }
 
-        void onRendererDone(float totalTimeSeconds) override
+        void onRendererDone(float totalTimeSeconds, float samplesPerPixel) override
         {
             PyGILState_STATE state = PyGILState_Ensure();
-            PyObject_CallMethod(mListenerObject, "on_render_done", "f", totalTimeSeconds);            
+            PyObject_CallMethod(mListenerObject, "on_render_done", "ff", totalTimeSeconds, samplesPerPixel);            
             PyGILState_Release(state);
         }
 
@@ -101,22 +109,40 @@ namespace App {
 
         Py_INCREF(engineObject->sceneObject);
 
+        if(settingsObject->samples == 0 && settingsObject->timeBudget <= 0) {
+            PyErr_SetString(PyExc_RuntimeError, "Samples must be non-zero unless a time budget is set");
+            return -1;
+        }
+
         wchar_t *renderMethod = PyUnicode_AsWideCharString(settingsObject->renderMethod, NULL);
-        if(!wcscmp(renderMethod, L"pathTracingGpu")) {
+        if(!wcscmp(renderMethod, L"pathTracingGpu") || !wcscmp(renderMethod, L"pathTracingHybrid")) {
             Render::Gpu::Renderer::Settings settings;
             settings.width = settingsObject->width;
             settings.height = settingsObject->height;
             settings.samples = settingsObject->samples;
+            settings.timeBudget = settingsObject->timeBudget;
+            settings.hybrid = !wcscmp(renderMethod, L"pathTracingHybrid");
+            if(settingsObject->gpuDevice && PyUnicode_Check(settingsObject->gpuDevice)) {
+                settings.device = PyUnicode_AsUTF8(settingsObject->gpuDevice);
+            }
 
-            engineObject->renderer = new Render::Gpu::Renderer(*engineObject->sceneObject->scene, settings);
+            try {
+                engineObject->renderer = new Render::Gpu::Renderer(*engineObject->sceneObject->scene, settings);
+            } catch(const std::exception &e) {
+                PyMem_Free(renderMethod);
+                PyErr_SetString(PyExc_RuntimeError, e.what());
+                return -1;
+            }
         } else if(!wcscmp(renderMethod, L"restir")) {
             Render::Cpu::RendererReSTIR::Settings settings;
             settings.width = settingsObject->width;
             settings.height = settingsObject->height;
             settings.samples = settingsObject->samples;
+            settings.timeBudget = settingsObject->timeBudget;
             settings.indirectSamples = settingsObject->restirIndirectSamples;
             settings.radius = settingsObject->restirRadius;
             settings.candidates = settingsObject->restirCandidates;
+            settings.spatialPasses = settingsObject->restirSpatialPasses;
 
             engineObject->renderer = new Render::Cpu::RendererReSTIR(*engineObject->sceneObject->scene, settings);
         } else {
@@ -124,6 +150,8 @@ namespace App {
             settings.width = settingsObject->width;
             settings.height = settingsObject->height;
             settings.samples = settingsObject->samples;
+            settings.timeBudget = settingsObject->timeBudget;
+            settings.adaptiveThreshold = settingsObject->adaptiveThreshold;
 
             std::unique_ptr<Render::Cpu::Lighter> lighter;
             if(!wcscmp(renderMethod, L"noLighting")) {
@@ -137,6 +165,9 @@ namespace App {
 
                 lighterSettings.indirectSamples = settingsObject->irradianceCacheSamples;
                 lighterSettings.cacheThreshold = settingsObject->irradianceCacheThreshold;
+                if(settingsObject->irradianceCacheFile && PyUnicode_Check(settingsObject->irradianceCacheFile)) {
+                    lighterSettings.cacheFile = PyUnicode_AsUTF8(settingsObject->irradianceCacheFile);
+                }
 
                 lighter = std::make_unique<Render::Cpu::Impl::Lighter::IrradianceCached>(lighterSettings);
             }
@@ -195,6 +226,62 @@ namespace App {
         return PyBool_FromLong(engineObject->renderer->running());
     }
 
+    static PyObject *Engine_updateFramebuffer(PyObject *self, PyObject *Py_UNUSED(ignored))
+    {
+        EngineObject *engineObject = (EngineObject*)self;
+
+        engineObject->renderer->updateFramebuffer();
+
+        Py_RETURN_NONE;
+    }
+
+    static PyObject *Engine_saveRadiance(PyObject *self, PyObject *args)
+    {
+        EngineObject *engineObject = (EngineObject*)self;
+
+        const char *filename;
+        if (!PyArg_ParseTuple(args, "s", &filename)) {
+            return NULL;
+        }
+
+        return PyBool_FromLong(Render::PfmFile::save(filename, *engineObject->renderer));
+    }
+
+    static PyObject *Engine_stats(PyObject *self, PyObject *Py_UNUSED(ignored))
+    {
+        EngineObject *engineObject = (EngineObject*)self;
+
+        Stats::Snapshot snapshot = engineObject->renderer->stats();
+        PyObject *ret = PyDict_New();
+        for(size_t i = 0; i < Stats::kNumCounters; i++) {
+            PyObject *value = PyLong_FromUnsignedLongLong(snapshot.counters[i]);
+            PyDict_SetItemString(ret, Stats::counterName(static_cast<Stats::Counter>(i)), value);
+            Py_DECREF(value);
+        }
+
+        for(size_t i = 0; i < Stats::kNumTimers; i++) {
+            std::string name = std::string(Stats::timerName(static_cast<Stats::Timer>(i))) + "_seconds";
+            PyObject *value = PyFloat_FromDouble(snapshot.timerSeconds[i]);
+            PyDict_SetItemString(ret, name.c_str(), value);
+            Py_DECREF(value);
+        }
+
+        return ret;
+    }
+
+    static PyObject *Engine_warnings(PyObject *self, PyObject *Py_UNUSED(ignored))
+    {
+        EngineObject *engineObject = (EngineObject*)self;
+
+        std::vector<std::string> warnings = engineObject->renderer->warnings();
+        PyObject *ret = PyList_New(warnings.size());
+        for(size_t i = 0; i < warnings.size(); i++) {
+            PyList_SetItem(ret, i, PyUnicode_FromString(warnings[i].c_str()));
+        }
+
+        return ret;
+    }
+
     static PyObject *Engine_renderProbe(PyObject *self, PyObject *args)
     {
         EngineObject *engineObject = (EngineObject*)self;
@@ -230,6 +317,10 @@ namespace App {
         {"start_render", (PyCFunction) Engine_startRender, METH_VARARGS, ""},
         {"stop", (PyCFunction) Engine_stop, METH_NOARGS, ""},
         {"rendering", (PyCFunction) Engine_rendering, METH_NOARGS, ""},
+        {"update_framebuffer", (PyCFunction) Engine_updateFramebuffer, METH_NOARGS, ""},
+        {"save_radiance", (PyCFunction) Engine_saveRadiance, METH_VARARGS, ""},
+        {"stats", (PyCFunction) Engine_stats, METH_NOARGS, ""},
+        {"warnings", (PyCFunction) Engine_warnings, METH_NOARGS, ""},
         {"renderProbe", (PyCFunction) Engine_renderProbe, METH_VARARGS, ""},
         {NULL}
     };
@@ -243,11 +334,16 @@ namespace App {
         {"width", T_UINT, offsetof(SettingsObject, width), 0},
         {"height", T_UINT, offsetof(SettingsObject, height), 0},
         {"samples", T_UINT, offsetof(SettingsObject, samples), 0},
+        {"adaptive_threshold", T_FLOAT, offsetof(SettingsObject, adaptiveThreshold), 0},
+        {"time_budget", T_FLOAT, offsetof(SettingsObject, timeBudget), 0},
         {"irradiance_cache_samples", T_UINT, offsetof(SettingsObject, irradianceCacheSamples), 0},
         {"irradiance_cache_threshold", T_FLOAT, offsetof(SettingsObject, irradianceCacheThreshold), 0},
+        {"irradiance_cache_file", T_OBJECT, offsetof(SettingsObject, irradianceCacheFile), 0},
         {"restir_indirect_samples", T_UINT, offsetof(SettingsObject, restirIndirectSamples), 0},
         {"restir_radius", T_UINT, offsetof(SettingsObject, restirRadius), 0},
         {"restir_candidates", T_UINT, offsetof(SettingsObject, restirCandidates), 0},
+        {"restir_spatial_passes", T_UINT, offsetof(SettingsObject, restirSpatialPasses), 0},
+        {"gpu_device", T_OBJECT, offsetof(SettingsObject, gpuDevice), 0},
         {"render_method", T_OBJECT, offsetof(SettingsObject, renderMethod), 0},
         {NULL}
     };
@@ -267,6 +363,15 @@ namespace App {
         return 0;
     }
 
+    static void Settings_dealloc(SettingsObject *settingsObject)
+    {
+        Py_XDECREF(settingsObject->irradianceCacheFile);
+        Py_XDECREF(settingsObject->gpuDevice);
+        Py_XDECREF(settingsObject->renderMethod);
+
+        Py_TYPE(settingsObject)->tp_free((PyObject*)settingsObject);
+    }
+
     static void Scene_dealloc(SceneObject *sceneObject)
     {
         if(sceneObject->scene) {
@@ -322,6 +427,7 @@ namespace App {
         SettingsType.tp_flags = Py_TPFLAGS_DEFAULT;
         SettingsType.tp_new = PyType_GenericNew;
         SettingsType.tp_members = Settings_members;
+        SettingsType.tp_dealloc = (destructor)Settings_dealloc;
 
         if(PyType_Ready(&SettingsType)) {
             return NULL;
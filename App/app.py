@@ -29,6 +29,8 @@ class App(QtWidgets.QApplication):
 
         self.mainwindow.renderMethodIrradianceCaching.toggled.connect(self.on_renderMethodIrradianceCaching_toggled)
         self.mainwindow.renderMethodRestir.toggled.connect(self.on_renderMethodRestir_toggled)
+        self.mainwindow.renderMethodPathTracingGpu.toggled.connect(self.on_renderMethodPathTracingGpu_toggled)
+        self.mainwindow.renderMethodPathTracingHybrid.toggled.connect(self.on_renderMethodPathTracingGpu_toggled)
         self.mainwindow.renderButton.clicked.connect(self.on_renderButton_clicked)
         self.mainwindow.saveButton.clicked.connect(self.on_saveButton_clicked)
         self.mainwindow.renderView.installEventFilter(self)
@@ -39,6 +41,7 @@ class App(QtWidgets.QApplication):
 
     @Slot()
     def on_timer(self):
+        self.engine.update_framebuffer()
         renderPainter = QtGui.QPainter(self.renderPixmap)
         renderPainter.drawImage(0, 0, self.renderImage)
         self.mainwindow.renderView.setPixmap(self.renderPixmap)
@@ -54,6 +57,11 @@ class App(QtWidgets.QApplication):
     def on_renderMethodRestir_toggled(self, checked):
         self.mainwindow.groupRestir.setEnabled(checked)
 
+    @Slot()
+    def on_renderMethodPathTracingGpu_toggled(self, checked):
+        gpu = self.mainwindow.renderMethodPathTracingGpu.isChecked() or self.mainwindow.renderMethodPathTracingHybrid.isChecked()
+        self.mainwindow.groupGpu.setEnabled(gpu)
+
     @Slot()
     def on_renderButton_clicked(self):
         if self.engine and self.engine.rendering():
@@ -63,18 +71,26 @@ class App(QtWidgets.QApplication):
             self.refreshSettings()
 
             scene = raytrace.Scene(self.mainwindow.scene.currentText())
-            self.engine = raytrace.Engine(scene, self.settings)
+            try:
+                self.engine = raytrace.Engine(scene, self.settings)
+            except RuntimeError as error:
+                self.engine = None
+                self.mainwindow.statusbar.showMessage(str(error))
+                return
 
             self.updateFramebuffer()
             self.engine.start_render(self)
-            self.mainwindow.statusbar.showMessage('')
+            self.mainwindow.statusbar.showMessage('; '.join(self.engine.warnings()))
             self.mainwindow.renderButton.setText('Stop Rendering')
             self.timer.start(100)
 
     @Slot()
     def on_saveButton_clicked(self):
-        (filename, _) = QtWidgets.QFileDialog.getSaveFileName(None, '', '', 'PNG Files (*.png)')
-        if filename != '':
+        (filename, _) = QtWidgets.QFileDialog.getSaveFileName(None, '', '', 'PNG Files (*.png);;PFM Files (*.pfm)')
+        if filename.lower().endswith('.pfm'):
+            if self.engine:
+                self.engine.save_radiance(filename)
+        elif filename != '':
             self.renderPixmap.save(filename)
 
     @Slot()
@@ -90,12 +106,15 @@ class App(QtWidgets.QApplication):
         self.settings.width = self.mainwindow.widthBox.value()
         self.settings.height = self.mainwindow.heightBox.value()
         self.settings.samples = self.mainwindow.samplesBox.value()
+        self.settings.adaptive_threshold = self.mainwindow.adaptiveThresholdBox.value()
+        self.settings.time_budget = self.mainwindow.timeBudgetBox.value()
 
         render_methods = [
             (self.mainwindow.renderMethodNoLighting, 'noLighting'),
             (self.mainwindow.renderMethodDirectLighting, 'directLighting'),
             (self.mainwindow.renderMethodPathTracingCpu, 'pathTracingCpu'),
             (self.mainwindow.renderMethodPathTracingGpu, 'pathTracingGpu'),
+            (self.mainwindow.renderMethodPathTracingHybrid, 'pathTracingHybrid'),
             (self.mainwindow.renderMethodRestir, 'restir'),
             (self.mainwindow.renderMethodIrradianceCaching, 'irradianceCaching')
         ]
@@ -106,10 +125,14 @@ class App(QtWidgets.QApplication):
 
         self.settings.irradiance_cache_samples = self.mainwindow.irradianceCachingSamples.value()
         self.settings.irradiance_cache_threshold = self.mainwindow.irradianceCachingThreshold.value()
+        self.settings.irradiance_cache_file = self.mainwindow.irradianceCachingFile.text()
 
         self.settings.restir_indirect_samples = self.mainwindow.restirIndirectSamples.value()
         self.settings.restir_radius = self.mainwindow.restirRadius.value()
         self.settings.restir_candidates = self.mainwindow.restirCandidates.value()
+        self.settings.restir_spatial_passes = self.mainwindow.restirSpatialPasses.value()
+
+        self.settings.gpu_device = self.mainwindow.gpuDevice.text()
 
     def updateFramebuffer(self):
         dpr = self.mainwindow.renderView.devicePixelRatio()
@@ -120,7 +143,7 @@ class App(QtWidgets.QApplication):
         self.renderPixmap = QtGui.QPixmap(self.engine.render_framebuffer.width, self.engine.render_framebuffer.height)
         self.renderPixmap.setDevicePixelRatio(dpr)
 
-    def on_render_done(self, total_time_seconds):
+    def on_render_done(self, total_time_seconds, samples_per_pixel):
         seconds = total_time_seconds
         hours = int(seconds / 3600)
         seconds -= hours * 3600
@@ -132,6 +155,7 @@ class App(QtWidgets.QApplication):
             message = 'Render time: %im %is' % (minutes, seconds)
         else:
             message = 'Render time: %.03fs' % seconds
+        message += ', %.01f samples/pixel' % samples_per_pixel
         self.mainwindow.statusbar.showMessage(message)
 
         self.mainwindow.renderButton.setText('Render')
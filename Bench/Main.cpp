@@ -0,0 +1,400 @@
+#define _USE_MATH_DEFINES
+#include "Parse/SceneParser.hpp"
+
+#include "Object/Impl/Shape/Transformed.hpp"
+#include "Object/Impl/Shape/TriangleMesh.hpp"
+
+#include "Math/Impl/Sampler/Random.hpp"
+
+#include "Render/Cpu/RendererLighter.hpp"
+#include "Render/Cpu/RendererReSTIR.hpp"
+#include "Render/Cpu/Impl/Lighter/Direct.hpp"
+#include "Render/Cpu/Impl/Lighter/UniPath.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cfloat>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Bench {
+    struct Options {
+        unsigned int rays = 200000;
+        unsigned int width = 160;
+        unsigned int height = 120;
+        unsigned int samples = 4;
+        std::string output;
+    };
+
+    struct BvhResult {
+        std::string name;
+        size_t nodes;
+        double buildSeconds;
+        float sahCost;
+    };
+
+    struct RayResult {
+        std::string name;
+        size_t rays;
+        double raysPerSecond;
+    };
+
+    struct RendererResult {
+        std::string method;
+        double seconds;
+        double samplesPerSecond;
+    };
+
+    struct SceneResult {
+        std::string name;
+        double loadSeconds;
+        std::vector<BvhResult> bvhs;
+        std::vector<RayResult> rays;
+        std::vector<RendererResult> renderers;
+    };
+
+    class Listener : public Render::Renderer::Listener
+    {
+    public:
+        void onRendererDone(float totalTimeSeconds, float samplesPerPixel) override
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTotalTimeSeconds = totalTimeSeconds;
+            mSamplesPerPixel = samplesPerPixel;
+            mDone = true;
+            mCondVar.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondVar.wait(lock, [&]() { return mDone; });
+        }
+
+        float totalTimeSeconds() const { return mTotalTimeSeconds; }
+        float samplesPerPixel() const { return mSamplesPerPixel; }
+
+    private:
+        std::mutex mMutex;
+        std::condition_variable mCondVar;
+        bool mDone = false;
+        float mTotalTimeSeconds = 0;
+        float mSamplesPerPixel = 0;
+    };
+
+    static const float kTraversalCost = 1.0f;
+    static const float kIntersectionCost = 1.0f;
+
+    static double secondsSince(const std::chrono::steady_clock::time_point &start)
+    {
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        return duration.count();
+    }
+
+    static float sahCost(const Object::BoundingVolumeHierarchy &boundingVolumeHierarchy)
+    {
+        const std::vector<Object::BoundingVolumeHierarchy::Node> &nodes = boundingVolumeHierarchy.nodes();
+        if(nodes.empty()) {
+            return 0;
+        }
+
+        float rootArea = nodes[0].volume.surfaceArea();
+        if(rootArea == 0) {
+            return 0;
+        }
+
+        float cost = 0;
+        for(const Object::BoundingVolumeHierarchy::Node &node : nodes) {
+            float probability = node.volume.surfaceArea() / rootArea;
+            cost += probability * ((node.index <= 0) ? kIntersectionCost : kTraversalCost);
+        }
+
+        return cost;
+    }
+
+    static void benchmarkBvhs(const Object::Scene &scene, std::vector<BvhResult> &results)
+    {
+        std::vector<Math::Point> centroids;
+        for(const std::unique_ptr<Object::Primitive> &primitive : scene.primitives()) {
+            centroids.push_back(primitive->boundingVolume().centroid());
+        }
+
+        auto func = [&](unsigned int index) {
+            return scene.primitives()[index]->boundingVolume();
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        Object::BoundingVolumeHierarchy sceneBvh(centroids, func);
+        double buildSeconds = secondsSince(start);
+        results.push_back(BvhResult{"scene", sceneBvh.nodes().size(), buildSeconds, sahCost(sceneBvh)});
+
+        for(unsigned int i = 0; i < scene.primitives().size(); i++) {
+            const Object::Shape *shape = &scene.primitives()[i]->shape();
+            while(const Object::Impl::Shape::Transformed *transformed = dynamic_cast<const Object::Impl::Shape::Transformed*>(shape)) {
+                shape = &transformed->shape();
+            }
+
+            const Object::Impl::Shape::TriangleMesh *mesh = dynamic_cast<const Object::Impl::Shape::TriangleMesh*>(shape);
+            if(!mesh) {
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            Object::BoundingVolumeHierarchy meshBvh = mesh->computeBoundingVolumeHierarchy();
+            double buildSeconds = secondsSince(start);
+            results.push_back(BvhResult{"mesh " + std::to_string(i), meshBvh.nodes().size(), buildSeconds, sahCost(meshBvh)});
+        }
+    }
+
+    static RayResult traceRays(const Object::Scene &scene, const std::string &name, const std::vector<Math::Beam> &beams, const std::vector<float> &maxDistances, bool closest)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < beams.size(); i++) {
+            scene.intersect(beams[i], maxDistances[i], closest);
+        }
+        double seconds = secondsSince(start);
+
+        return RayResult{name, beams.size(), (seconds > 0) ? beams.size() / seconds : 0};
+    }
+
+    static void benchmarkRays(const Object::Scene &scene, const Options &options, std::vector<RayResult> &results)
+    {
+        Math::Impl::Sampler::Random sampler;
+
+        std::vector<Math::Beam> primaryBeams;
+        for(unsigned int i = 0; i < options.rays; i++) {
+            unsigned int x = i % options.width;
+            unsigned int y = (i / options.width) % options.height;
+            Math::Point2D imagePoint = Math::Point2D((float)x, (float)y) + sampler.getValue2D();
+            primaryBeams.push_back(scene.camera().createPixelBeam(imagePoint, options.width, options.height, Math::Point2D()));
+        }
+        results.push_back(traceRays(scene, "primary", primaryBeams, std::vector<float>(primaryBeams.size(), FLT_MAX), true));
+
+        std::vector<Math::Beam> shadowBeams;
+        std::vector<float> shadowDistances;
+        std::vector<Math::Beam> incoherentBeams;
+        for(const Math::Beam &beam : primaryBeams) {
+            Object::Intersection isect = scene.intersect(beam, FLT_MAX, true);
+            if(!isect.valid()) {
+                continue;
+            }
+
+            const Math::Normal &nrmFacing = isect.facingNormal();
+            Math::Point pntOffset = isect.point() + Math::Vector(nrmFacing) * 0.01f;
+
+            if(!scene.areaLights().empty()) {
+                int lightIndex = std::min((int)(sampler.getValue() * scene.areaLights().size()), (int)scene.areaLights().size() - 1);
+                const Object::Primitive &light = scene.areaLights()[lightIndex];
+                auto [pntLight, nrmLight, pdfLight] = light.shape().sample(sampler);
+
+                Math::Vector dirIn = pntLight - pntOffset;
+                float distance = dirIn.magnitude();
+                if(distance > 0) {
+                    shadowBeams.push_back(Math::Beam(Math::Ray(pntOffset, dirIn / distance), Math::Bivector(), Math::Bivector()));
+                    shadowDistances.push_back(distance * 0.999f);
+                }
+            }
+
+            float z = 1 - 2 * sampler.getValue();
+            float r = std::sqrt(std::max(0.0f, 1 - z * z));
+            float phi = 2 * (float)M_PI * sampler.getValue();
+            Math::Vector dirIn(r * std::cos(phi), r * std::sin(phi), z);
+            if(dirIn * nrmFacing < 0) {
+                dirIn = -dirIn;
+            }
+            incoherentBeams.push_back(Math::Beam(Math::Ray(pntOffset, dirIn), Math::Bivector(), Math::Bivector()));
+        }
+
+        results.push_back(traceRays(scene, "shadow", shadowBeams, shadowDistances, false));
+        results.push_back(traceRays(scene, "incoherent", incoherentBeams, std::vector<float>(incoherentBeams.size(), FLT_MAX), true));
+    }
+
+    static RendererResult runRenderer(Render::Renderer &renderer, const std::string &method, const Options &options)
+    {
+        Listener listener;
+        renderer.start(&listener);
+        listener.wait();
+
+        double samples = double(options.width) * options.height * listener.samplesPerPixel();
+        double seconds = listener.totalTimeSeconds();
+        return RendererResult{method, seconds, (seconds > 0) ? samples / seconds : 0};
+    }
+
+    static void benchmarkRenderers(const Object::Scene &scene, const Options &options, std::vector<RendererResult> &results)
+    {
+        Render::Cpu::RendererLighter::Settings lighterSettings;
+        lighterSettings.width = options.width;
+        lighterSettings.height = options.height;
+        lighterSettings.samples = options.samples;
+        lighterSettings.adaptiveThreshold = 0;
+        lighterSettings.timeBudget = 0;
+
+        {
+            Render::Cpu::RendererLighter renderer(scene, lighterSettings, std::make_unique<Render::Cpu::Impl::Lighter::Direct>());
+            results.push_back(runRenderer(renderer, "directLighting", options));
+        }
+
+        {
+            Render::Cpu::RendererLighter renderer(scene, lighterSettings, std::make_unique<Render::Cpu::Impl::Lighter::UniPath>());
+            results.push_back(runRenderer(renderer, "pathTracingCpu", options));
+        }
+
+        Render::Cpu::RendererReSTIR::Settings restirSettings;
+        restirSettings.width = options.width;
+        restirSettings.height = options.height;
+        restirSettings.samples = options.samples;
+        restirSettings.timeBudget = 0;
+        restirSettings.indirectSamples = 10;
+        restirSettings.radius = 30;
+        restirSettings.candidates = 30;
+        restirSettings.spatialPasses = 1;
+
+        {
+            Render::Cpu::RendererReSTIR renderer(scene, restirSettings);
+            results.push_back(runRenderer(renderer, "restir", options));
+        }
+    }
+
+    static std::string jsonString(const std::string &value)
+    {
+        std::string result;
+        for(char c : value) {
+            if(c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if((unsigned char)c < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)c);
+                result += escaped;
+            } else {
+                result += c;
+            }
+        }
+
+        return result;
+    }
+
+    static void writeJson(FILE *file, const std::vector<SceneResult> &scenes)
+    {
+        std::fprintf(file, "{\n  \"scenes\": [");
+        for(size_t i = 0; i < scenes.size(); i++) {
+            const SceneResult &scene = scenes[i];
+            std::fprintf(file, "%s\n    {\n", (i > 0) ? "," : "");
+            std::fprintf(file, "      \"name\": \"%s\",\n", jsonString(scene.name).c_str());
+            std::fprintf(file, "      \"load_seconds\": %g,\n", scene.loadSeconds);
+
+            std::fprintf(file, "      \"bvh\": [");
+            for(size_t j = 0; j < scene.bvhs.size(); j++) {
+                const BvhResult &bvh = scene.bvhs[j];
+                std::fprintf(file, "%s\n        {\"name\": \"%s\", \"nodes\": %zu, \"build_seconds\": %g, \"sah_cost\": %g}", (j > 0) ? "," : "", jsonString(bvh.name).c_str(), bvh.nodes, bvh.buildSeconds, bvh.sahCost);
+            }
+            std::fprintf(file, "\n      ],\n");
+
+            std::fprintf(file, "      \"rays\": [");
+            for(size_t j = 0; j < scene.rays.size(); j++) {
+                const RayResult &rays = scene.rays[j];
+                std::fprintf(file, "%s\n        {\"name\": \"%s\", \"rays\": %zu, \"rays_per_second\": %g}", (j > 0) ? "," : "", jsonString(rays.name).c_str(), rays.rays, rays.raysPerSecond);
+            }
+            std::fprintf(file, "\n      ],\n");
+
+            std::fprintf(file, "      \"renderers\": [");
+            for(size_t j = 0; j < scene.renderers.size(); j++) {
+                const RendererResult &renderer = scene.renderers[j];
+                std::fprintf(file, "%s\n        {\"method\": \"%s\", \"seconds\": %g, \"samples_per_second\": %g}", (j > 0) ? "," : "", jsonString(renderer.method).c_str(), renderer.seconds, renderer.samplesPerSecond);
+            }
+            std::fprintf(file, "\n      ]\n    }");
+        }
+        std::fprintf(file, "\n  ]\n}\n");
+    }
+
+    static bool parseOption(const std::string &name, const std::string &value, Options &options)
+    {
+        if(name == "rays") {
+            options.rays = std::stoul(value);
+        } else if(name == "width") {
+            options.width = std::stoul(value);
+        } else if(name == "height") {
+            options.height = std::stoul(value);
+        } else if(name == "samples") {
+            options.samples = std::stoul(value);
+        } else if(name == "output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Bench::Options options;
+    std::vector<std::string> sceneFiles;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg.compare(0, 2, "--") != 0) {
+            sceneFiles.push_back(arg);
+            continue;
+        }
+
+        size_t equals = arg.find('=');
+        bool valid = false;
+        if(equals != std::string::npos) {
+            try {
+                valid = Bench::parseOption(arg.substr(2, equals - 2), arg.substr(equals + 1), options);
+            } catch(const std::exception &) {
+                valid = false;
+            }
+        }
+
+        if(!valid) {
+            std::fprintf(stderr, "Invalid option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if(sceneFiles.empty() || options.width == 0 || options.height == 0 || options.samples == 0) {
+        std::fprintf(stderr, "Usage: %s [--rays=N] [--width=N] [--height=N] [--samples=N] [--output=file.json] <scene> [<scene> ...]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<Bench::SceneResult> results;
+    for(const std::string &sceneFile : sceneFiles) {
+        Bench::SceneResult result;
+        result.name = sceneFile;
+
+        auto start = std::chrono::steady_clock::now();
+        Parse::SceneParser parser(sceneFile);
+        std::unique_ptr<Object::Scene> scene = parser.parse();
+        result.loadSeconds = Bench::secondsSince(start);
+
+        Bench::benchmarkBvhs(*scene, result.bvhs);
+        Bench::benchmarkRays(*scene, options, result.rays);
+        Bench::benchmarkRenderers(*scene, options, result.renderers);
+
+        results.push_back(std::move(result));
+    }
+
+    FILE *file = stdout;
+    if(!options.output.empty()) {
+        file = std::fopen(options.output.c_str(), "w");
+        if(!file) {
+            std::fprintf(stderr, "Failed to open %s\n", options.output.c_str());
+            return 1;
+        }
+    }
+
+    Bench::writeJson(file, results);
+
+    if(file != stdout) {
+        std::fclose(file);
+    }
+
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include "Parse/SceneParser.hpp"
+
+#include "Render/Cpu/RendererLighter.hpp"
+#include "Render/Cpu/RendererReSTIR.hpp"
+#include "Render/Cpu/Impl/Lighter/Direct.hpp"
+#include "Render/Cpu/Impl/Lighter/UniPath.hpp"
+#include "Render/Cpu/Impl/Lighter/IrradianceCached.hpp"
+
+#include "Render/Gpu/Renderer.hpp"
+
+#include "Render/PfmFile.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Cli {
+    struct Settings {
+        unsigned int width = 1280;
+        unsigned int height = 960;
+        unsigned int samples = 10;
+        float adaptiveThreshold = 0.0f;
+        float timeBudget = 0.0f;
+        unsigned int irradianceCacheSamples = 1000;
+        float irradianceCacheThreshold = 0.1f;
+        std::string irradianceCacheFile;
+        unsigned int restirIndirectSamples = 10;
+        unsigned int restirRadius = 30;
+        unsigned int restirCandidates = 30;
+        unsigned int restirSpatialPasses = 1;
+        std::string gpuDevice;
+        std::string renderMethod = "pathTracingCpu";
+    };
+
+    class Listener : public Render::Renderer::Listener
+    {
+    public:
+        void onRendererDone(float totalTimeSeconds, float samplesPerPixel) override
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTotalTimeSeconds = totalTimeSeconds;
+            mSamplesPerPixel = samplesPerPixel;
+            mDone = true;
+            mCondVar.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondVar.wait(lock, [&]() { return mDone; });
+        }
+
+        float totalTimeSeconds() const { return mTotalTimeSeconds; }
+        float samplesPerPixel() const { return mSamplesPerPixel; }
+
+    private:
+        std::mutex mMutex;
+        std::condition_variable mCondVar;
+        bool mDone = false;
+        float mTotalTimeSeconds = 0;
+        float mSamplesPerPixel = 0;
+    };
+
+    static bool parseOption(const std::string &name, const std::string &value, Settings &settings)
+    {
+        if(name == "width") {
+            settings.width = std::stoul(value);
+        } else if(name == "height") {
+            settings.height = std::stoul(value);
+        } else if(name == "samples") {
+            settings.samples = std::stoul(value);
+        } else if(name == "adaptive_threshold") {
+            settings.adaptiveThreshold = std::stof(value);
+        } else if(name == "time_budget") {
+            settings.timeBudget = std::stof(value);
+        } else if(name == "irradiance_cache_samples") {
+            settings.irradianceCacheSamples = std::stoul(value);
+        } else if(name == "irradiance_cache_threshold") {
+            settings.irradianceCacheThreshold = std::stof(value);
+        } else if(name == "irradiance_cache_file") {
+            settings.irradianceCacheFile = value;
+        } else if(name == "restir_indirect_samples") {
+            settings.restirIndirectSamples = std::stoul(value);
+        } else if(name == "restir_radius") {
+            settings.restirRadius = std::stoul(value);
+        } else if(name == "restir_candidates") {
+            settings.restirCandidates = std::stoul(value);
+        } else if(name == "restir_spatial_passes") {
+            settings.restirSpatialPasses = std::stoul(value);
+        } else if(name == "gpu_device") {
+            settings.gpuDevice = value;
+        } else if(name == "render_method") {
+            settings.renderMethod = value;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    static std::unique_ptr<Render::Renderer> createRenderer(const Object::Scene &scene, const Settings &cliSettings)
+    {
+        if(cliSettings.renderMethod == "pathTracingGpu" || cliSettings.renderMethod == "pathTracingHybrid") {
+            Render::Gpu::Renderer::Settings settings;
+            settings.width = cliSettings.width;
+            settings.height = cliSettings.height;
+            settings.samples = cliSettings.samples;
+            settings.timeBudget = cliSettings.timeBudget;
+            settings.device = cliSettings.gpuDevice;
+            settings.hybrid = (cliSettings.renderMethod == "pathTracingHybrid");
+
+            return std::make_unique<Render::Gpu::Renderer>(scene, settings);
+        } else if(cliSettings.renderMethod == "restir") {
+            Render::Cpu::RendererReSTIR::Settings settings;
+            settings.width = cliSettings.width;
+            settings.height = cliSettings.height;
+            settings.samples = cliSettings.samples;
+            settings.timeBudget = cliSettings.timeBudget;
+            settings.indirectSamples = cliSettings.restirIndirectSamples;
+            settings.radius = cliSettings.restirRadius;
+            settings.candidates = cliSettings.restirCandidates;
+            settings.spatialPasses = cliSettings.restirSpatialPasses;
+
+            return std::make_unique<Render::Cpu::RendererReSTIR>(scene, settings);
+        }
+
+        Render::Cpu::RendererLighter::Settings settings;
+        settings.width = cliSettings.width;
+        settings.height = cliSettings.height;
+        settings.samples = cliSettings.samples;
+        settings.timeBudget = cliSettings.timeBudget;
+        settings.adaptiveThreshold = cliSettings.adaptiveThreshold;
+
+        std::unique_ptr<Render::Cpu::Lighter> lighter;
+        if(cliSettings.renderMethod == "noLighting") {
+            lighter = nullptr;
+        } else if(cliSettings.renderMethod == "directLighting") {
+            lighter = std::make_unique<Render::Cpu::Impl::Lighter::Direct>();
+        } else if(cliSettings.renderMethod == "pathTracingCpu") {
+            lighter = std::make_unique<Render::Cpu::Impl::Lighter::UniPath>();
+        } else if(cliSettings.renderMethod == "irradianceCaching") {
+            Render::Cpu::Impl::Lighter::IrradianceCached::Settings lighterSettings;
+            lighterSettings.indirectSamples = cliSettings.irradianceCacheSamples;
+            lighterSettings.cacheThreshold = cliSettings.irradianceCacheThreshold;
+            lighterSettings.cacheFile = cliSettings.irradianceCacheFile;
+
+            lighter = std::make_unique<Render::Cpu::Impl::Lighter::IrradianceCached>(lighterSettings);
+        } else {
+            return nullptr;
+        }
+
+        return std::make_unique<Render::Cpu::RendererLighter>(scene, settings, std::move(lighter));
+    }
+
+    static bool savePpm(const std::string &filename, const Render::Framebuffer &framebuffer)
+    {
+        std::ofstream file(filename.c_str(), std::ios_base::binary);
+        if(!file) {
+            return false;
+        }
+
+        file << "P6\n" << framebuffer.width() << " " << framebuffer.height() << "\n255\n";
+        file.write((const char*)framebuffer.bits(), framebuffer.width() * framebuffer.height() * 3);
+
+        return file.good();
+    }
+
+    static bool hasSuffix(const std::string &string, const std::string &suffix)
+    {
+        return string.size() >= suffix.size() && string.compare(string.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    static void printUsage(const char *program)
+    {
+        std::fprintf(stderr, "Usage: %s <scene> <output.ppm|output.pfm> [--setting=value ...]\n", program);
+        std::fprintf(stderr, "Settings: width, height, samples, adaptive_threshold, time_budget, render_method,\n");
+        std::fprintf(stderr, "  irradiance_cache_samples, irradiance_cache_threshold, irradiance_cache_file,\n");
+        std::fprintf(stderr, "  restir_indirect_samples, restir_radius, restir_candidates,\n");
+        std::fprintf(stderr, "  restir_spatial_passes, gpu_device (gpu, cpu, all, <index>, <name> or a comma-separated list)\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3) {
+        Cli::printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string sceneFile = argv[1];
+    std::string outputFile = argv[2];
+
+    Cli::Settings settings;
+    for(int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+            Cli::printUsage(argv[0]);
+            return 1;
+        }
+
+        std::string name = arg.substr(2, equals - 2);
+        std::string value = arg.substr(equals + 1);
+        bool valid;
+        try {
+            valid = Cli::parseOption(name, value, settings);
+        } catch(const std::exception &) {
+            valid = false;
+        }
+
+        if(!valid) {
+            std::fprintf(stderr, "Invalid setting: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if(settings.samples == 0 && settings.timeBudget <= 0) {
+        std::fprintf(stderr, "samples must be non-zero unless time_budget is set\n");
+        return 1;
+    }
+
+    Parse::SceneParser parser(sceneFile);
+    std::unique_ptr<Object::Scene> scene = parser.parse();
+
+    std::unique_ptr<Render::Renderer> renderer;
+    try {
+        renderer = Cli::createRenderer(*scene, settings);
+    } catch(const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if(!renderer) {
+        std::fprintf(stderr, "Unknown render method: %s\n", settings.renderMethod.c_str());
+        return 1;
+    }
+
+    for(const std::string &warning : renderer->warnings()) {
+        std::fprintf(stderr, "%s\n", warning.c_str());
+    }
+
+    Cli::Listener listener;
+    renderer->start(&listener);
+    listener.wait();
+
+    bool saved;
+    if(Cli::hasSuffix(outputFile, ".pfm")) {
+        saved = Render::PfmFile::save(outputFile, *renderer);
+    } else {
+        renderer->updateFramebuffer();
+        saved = Cli::savePpm(outputFile, renderer->renderFramebuffer());
+    }
+
+    if(!saved) {
+        std::fprintf(stderr, "Failed to write %s\n", outputFile.c_str());
+        return 1;
+    }
+
+    std::printf("Render time: %.03fs, %.01f samples/pixel\n", listener.totalTimeSeconds(), listener.samplesPerPixel());
+
+    return 0;
+}
@@ -133,6 +133,18 @@ namespace Object {
         return Math::Point((v1 % v2) * (d0 / d) + (v2 % v0) * (d1 / d) + (v0 % v1) * (d2 / d));
     }
 
+    float BoundingVolume::surfaceArea() const
+    {
+        float x = mMaxes[0] - mMins[0];
+        float y = mMaxes[1] - mMins[1];
+        float z = mMaxes[2] - mMins[2];
+        if(x < 0 || y < 0 || z < 0) {
+            return 0;
+        }
+
+        return 2 * (x * y + y * z + z * x);
+    }
+
     void BoundingVolume::writeProxy(BoundingVolumeProxy &proxy) const
     {
         for(int i=0; i<NUM_VECTORS; i++) {
@@ -27,6 +27,7 @@ namespace Object {
         void expand(const BoundingVolume &volume);
 
         Math::Point centroid() const;
+        float surfaceArea() const;
 
         void writeProxy(BoundingVolumeProxy &proxy) const;
 
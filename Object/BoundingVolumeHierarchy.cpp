@@ -1,4 +1,7 @@
 #include "Object/BoundingVolumeHierarchy.hpp"
+
+#include "Stats.hpp"
+
 #include <cfloat>
 #include <algorithm>
 
@@ -49,7 +52,8 @@ namespace Object {
             int nodeIndex = stack[n].nodeIndex;
             const Node &node = mNodes[nodeIndex];
             float nodeMinimum = stack[n].minDistance;
-            
+            Stats::count(Stats::Counter::BvhNodesVisited);
+
             if(nodeMinimum > maxDistance) {
                 continue;
             }
@@ -140,9 +144,17 @@ namespace Object {
 
     void BoundingVolumeHierarchy::writeProxy(BVHNodeProxy *proxy) const
     {
+        if(mNodes.size() > 0) {
+            proxy[0].escape = -1;
+        }
+
         for(int i=0; i<mNodes.size(); i++) {
             proxy[i].index = mNodes[i].index;
             mNodes[i].volume.writeProxy(proxy[i].volume);
+            if(mNodes[i].index > 0) {
+                proxy[i + 1].escape = mNodes[i].index;
+                proxy[mNodes[i].index].escape = proxy[i].escape;
+            }
         }
     }
 }
@@ -106,6 +106,16 @@ Color Surface_transmitted(Intersection *isect, Vector dirIn)
     return colTransmit;
 }
 
+int Surface_sortKey(Surface *surf)
+{
+    int key = surf->opaque ? 0 : 1;
+    for(int i=0; i<surf->numBrdfs; i++) {
+        key |= 2 << surf->brdfs[i].type;
+    }
+
+    return key;
+}
+
 Color Surface_sample(Intersection *isect, Sampler *sampler, SamplerState *samplerState, Vector *dirIn, float *pdf, bool *pdfDelta)
 {
     Surface *surf = &isect->primitive->surface;
@@ -146,58 +156,101 @@ Color Surface_sample(Intersection *isect, Sampler *sampler, SamplerState *sample
     return Surface_reflected(isect, *dirIn);
 }
 
-void Scene_intersect(Scene *scene, Beam *beam, Intersection *isect, float maxDistance, bool closest)
+bool Scene_traverse(Scene *scene, Ray *ray, ShapeIntersection *isectShape, bool closest, Primitive *ignore, Primitive **primitiveHit)
 {
-    isect->shapeIntersection.distance = maxDistance;
-    isect->primitive = NULL;
-    isect->beam = beam;
+    bool ret = false;
+    Primitive *primitive = NULL;
+    Shape *meshShape = NULL;
+    BVHNode *meshBvh = NULL;
+    Ray meshRay;
+    int sceneEscape = -1;
+    int nodeIndex = 0;
+
+    while(nodeIndex != -1) {
+        if(meshShape) {
+            BVHNode *bvhNode = &meshBvh[nodeIndex];
+
+            if(!BVHNode_intersect(bvhNode, &meshRay, isectShape->distance)) {
+                nodeIndex = bvhNode->escape;
+            } else if(bvhNode->index <= 0) {
+                bool hit;
+                if(meshShape->type == ShapeTypeTriangleMesh) {
+                    hit = ShapeTriangleMesh_intersectTriangle(&meshRay, &meshShape->triangleMesh, -bvhNode->index, isectShape);
+                } else {
+                    hit = ShapeGrid_intersectCell(&meshRay, &meshShape->grid, -bvhNode->index, isectShape, closest);
+                }
 
-    StackEntry stack[64];
+                if(hit) {
+                    *primitiveHit = primitive;
+                    ret = true;
+                    if(!closest) {
+                        break;
+                    }
+                }
+                nodeIndex = bvhNode->escape;
+            } else {
+                nodeIndex++;
+            }
 
-    int n = 0;
-    stack[n].nodeIndex = 0;
-    stack[n].minDistance = 0;
-    n++;
+            if(nodeIndex == -1) {
+                meshShape = NULL;
+                nodeIndex = sceneEscape;
+            }
+            continue;
+        }
 
-    do {
-        n--;
-        int nodeIndex = stack[n].nodeIndex;
         BVHNode *bvhNode = &scene->bvh[nodeIndex];
-        float nodeMinimum = stack[n].minDistance;
+        if(!BVHNode_intersect(bvhNode, ray, isectShape->distance)) {
+            nodeIndex = bvhNode->escape;
+            continue;
+        }
 
-        if(nodeMinimum > isect->shapeIntersection.distance) {
+        if(bvhNode->index > 0) {
+            nodeIndex++;
             continue;
         }
 
-        if(bvhNode->index <= 0) {
-            int index = -bvhNode->index;
+        nodeIndex = bvhNode->escape;
+        primitive = &scene->primitives[-bvhNode->index];
+        if(primitive == ignore) {
+            continue;
+        }
 
-            if(Shape_intersect(&beam->ray, &scene->primitives[index].shape, &isect->shapeIntersection, closest)) {
-                isect->primitive = &scene->primitives[index];
-                if(!closest) {
-                    break;
-                }
-            }
-        } else {
-            int indices[2] = { nodeIndex + 1, bvhNode->index };
-            float minDistances[2];
-            float maxDistances[2];
-            for(int i=0; i<2; i++) {
-                minDistances[i] = MAXFLOAT;
-                maxDistances[i] = -MAXFLOAT;
-                BoundingVolume_intersect(&bvhNode->volume, &beam->ray, &minDistances[i], &maxDistances[i]);
-            }
+        Shape *shape = &primitive->shape;
+        meshRay = *ray;
+        if(shape->type == ShapeTypeTransformed) {
+            ShapeTransformed_transformRay(&shape->transformed, ray, &meshRay);
+            shape = shape->transformed.shape;
+        }
 
-            for(int i=0; i<2; i++) {
-                int j = (minDistances[0] >= minDistances[1]) ? i : 1 - i;
-                if(maxDistances[j] > 0) {
-                    stack[n].nodeIndex = indices[j];
-                    stack[n].minDistance = minDistances[j];
-                    n++;
-                }
+        if(shape->type == ShapeTypeTriangleMesh || shape->type == ShapeTypeGrid) {
+            meshShape = shape;
+            meshBvh = (shape->type == ShapeTypeTriangleMesh) ? shape->triangleMesh.bvh : shape->grid.bvh;
+            sceneEscape = nodeIndex;
+            nodeIndex = 0;
+        } else if(Shape_intersect_2(&meshRay, shape, isectShape, closest)) {
+            *primitiveHit = primitive;
+            ret = true;
+            if(!closest) {
+                break;
             }
         }
-    } while(n > 0);
+    }
+
+    return ret;
+}
+
+void Scene_intersect(Scene *scene, Beam *beam, Intersection *isect, float maxDistance, bool closest)
+{
+    isect->shapeIntersection.distance = maxDistance;
+    isect->primitive = NULL;
+    isect->beam = beam;
+
+    Scene_traverse(scene, &beam->ray, &isect->shapeIntersection, closest, NULL, &isect->primitive);
+
+    if(isect->primitive != 0 && isect->primitive->shape.type == ShapeTypeTransformed) {
+        ShapeTransformed_transformIntersection(&isect->primitive->shape.transformed, &isect->shapeIntersection);
+    }
 
     if(isect->primitive != 0) {
         isect->point = beam->ray.origin + beam->ray.direction * isect->shapeIntersection.distance;
@@ -223,3 +276,11 @@ void Scene_intersect(Scene *scene, Beam *beam, Intersection *isect, float maxDis
     }
 }
 
+bool Scene_occluded(Scene *scene, Ray *ray, float maxDistance, Primitive *ignore)
+{
+    ShapeIntersection shapeIntersection;
+    shapeIntersection.distance = maxDistance;
+
+    Primitive *primitive = NULL;
+    return Scene_traverse(scene, ray, &shapeIntersection, false, ignore, &primitive);
+}
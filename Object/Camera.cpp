@@ -51,6 +51,11 @@ namespace Object {
         return size * mImageSize * distance;
     }
 
+    const Math::Point &Camera::position() const
+    {
+        return mPosition;
+    }
+
     void Camera::writeProxy(CameraProxy &proxy) const
     {
         mPosition.writeProxy(proxy.position);
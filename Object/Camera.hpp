@@ -19,6 +19,7 @@ namespace Object {
         Math::Ray createRay(const Math::Point2D &imagePoint, const Math::Point2D &aperturePoint, Math::Bivector &differential) const;
         Math::Beam createPixelBeam(const Math::Point2D &imagePoint, unsigned int width, unsigned int height, const Math::Point2D &aperturePoint) const;
         float projectSize(float size, float distance) const;
+        const Math::Point &position() const;
 
         void writeProxy(CameraProxy &proxy) const;
 
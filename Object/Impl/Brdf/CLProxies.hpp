@@ -26,7 +26,8 @@ struct BrdfProxy {
         Lambert,
         OrenNayar,
         Phong,
-        TorranceSparrow
+        TorranceSparrow,
+        NumTypes
     };
 
     Type type;
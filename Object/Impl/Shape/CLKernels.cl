@@ -6,6 +6,7 @@ typedef struct {
 typedef struct {
     BoundingVolume volume;
     int index;
+    int escape;
 } BVHNode;
 
 typedef struct {
@@ -250,147 +251,116 @@ bool BoundingVolume_intersect(BoundingVolume *volume, Ray *ray, float *minDistan
     return true;
 }
 
-typedef struct {
-    int nodeIndex;
-    float minDistance;
-} StackEntry;
+bool BVHNode_intersect(BVHNode *bvhNode, Ray *ray, float maxDistance)
+{
+    float minDistanceNode;
+    float maxDistanceNode;
+    return BoundingVolume_intersect(&bvhNode->volume, ray, &minDistanceNode, &maxDistanceNode) && minDistanceNode <= maxDistance;
+}
 
-bool ShapeTriangleMesh_intersect(Ray *ray, ShapeTriangleMesh *triangleMesh, ShapeIntersection *isectShape, bool closest)
+bool ShapeTriangleMesh_intersectTriangle(Ray *ray, ShapeTriangleMesh *triangleMesh, int index, ShapeIntersection *isectShape)
 {
-    StackEntry stack[64];
+    Triangle *triangle = &triangleMesh->triangles[index];
+    Point vertex0 = triangleMesh->vertices[triangle->vertices[0]];
+    Point vertex1 = triangleMesh->vertices[triangle->vertices[1]];
+    Point vertex2 = triangleMesh->vertices[triangle->vertices[2]];
+
+    float tu, tv;
+    if(Triangle_intersect(ray, vertex0, vertex1, vertex2, &isectShape->distance, &tu, &tv)) {
+        isectShape->normal = triangle->normal;
+        isectShape->tangent.u = (Vector)(0,0,0);
+        isectShape->tangent.v = (Vector)(0,0,0);
+        isectShape->surfacePoint = (Point2D)(0,0);
+        return true;
+    }
 
+    return false;
+}
+
+bool ShapeTriangleMesh_intersect(Ray *ray, ShapeTriangleMesh *triangleMesh, ShapeIntersection *isectShape, bool closest)
+{
     bool ret = false;
-    int n = 0;
-    stack[n].nodeIndex = 0;
-    stack[n].minDistance = 0;
-    n++;
-
-    do {
-        n--;
-        int nodeIndex = stack[n].nodeIndex;
-        BVHNode *bvhNode = &triangleMesh->bvh[nodeIndex];
-        float nodeMinimum = stack[n].minDistance;
+    int nodeIndex = 0;
 
-        if(nodeMinimum > isectShape->distance) {
-            continue;
-        }
+    while(nodeIndex != -1) {
+        BVHNode *bvhNode = &triangleMesh->bvh[nodeIndex];
 
-        if(bvhNode->index <= 0) {
-            int index = -bvhNode->index;
-            Triangle *triangle = &triangleMesh->triangles[index];
-            Point vertex0 = triangleMesh->vertices[triangle->vertices[0]];
-            Point vertex1 = triangleMesh->vertices[triangle->vertices[1]];
-            Point vertex2 = triangleMesh->vertices[triangle->vertices[2]];
-
-            float tu, tv;
-            if(Triangle_intersect(ray, vertex0, vertex1, vertex2, &isectShape->distance, &tu, &tv)) {
-                isectShape->normal = triangle->normal;
-                isectShape->tangent.u = (Vector)(0,0,0);
-                isectShape->tangent.v = (Vector)(0,0,0);
-                isectShape->surfacePoint = (Point2D)(0,0);
+        if(!BVHNode_intersect(bvhNode, ray, isectShape->distance)) {
+            nodeIndex = bvhNode->escape;
+        } else if(bvhNode->index <= 0) {
+            if(ShapeTriangleMesh_intersectTriangle(ray, triangleMesh, -bvhNode->index, isectShape)) {
                 ret = true;
                 if(!closest) {
                     break;
                 }
             }
+            nodeIndex = bvhNode->escape;
         } else {
-            int indices[2] = { nodeIndex + 1, bvhNode->index };
-            float minDistances[2];
-            float maxDistances[2];
-            for(int i=0; i<2; i++) {
-                minDistances[i] = MAXFLOAT;
-                maxDistances[i] = -MAXFLOAT;
-                BoundingVolume_intersect(&bvhNode->volume, ray, &minDistances[i], &maxDistances[i]);
-            }
+            nodeIndex++;
+        }
+    }
 
-            for(int i=0; i<2; i++) {
-                int j = (minDistances[0] >= minDistances[1]) ? i : 1 - i;
-                if(maxDistances[j] > 0) {
-                    stack[n].nodeIndex = indices[j];
-                    stack[n].minDistance = minDistances[j];
-                    n++;
-                }
-            }
+    return ret;
+}
+
+bool ShapeGrid_intersectCell(Ray *ray, ShapeGrid *grid, int index, ShapeIntersection *isectShape, bool closest)
+{
+    unsigned int u = index % grid->width;
+    unsigned int v = index / grid->width;
+    GridVertex *vertex0 = &grid->vertices[v * grid->width + u];
+    Point2D pntSurf0 = (Point2D)((float)u / grid->width, (float)v / grid->height);
+    GridVertex *vertex1 = &grid->vertices[v * grid->width + u + 1];
+    Point2D pntSurf1 = (Point2D)((float)(u + 1) / grid->width, (float)v / grid->height);
+    GridVertex *vertex2 = &grid->vertices[(v + 1) * grid->width + u];
+    Point2D pntSurf2 = (Point2D)((float)u / grid->width, (float)(v + 1) / grid->height);
+    GridVertex *vertex3 = &grid->vertices[(v + 1) * grid->width + u + 1];
+    Point2D pntSurf3 = (Point2D)((float)(u + 1) / grid->width, (float)(v + 1) / grid->height);
+
+    bool ret = false;
+    float tu, tv;
+    if(Triangle_intersect(ray, vertex0->point, vertex1->point, vertex2->point, &isectShape->distance, &tu, &tv)) {
+        isectShape->normal = vertex0->normal * (1 - tu - tv) + vertex1->normal * tu + vertex2->normal * tv;
+        isectShape->tangent.u = vertex0->tangent.u * (1 - tu - tv) + vertex1->tangent.u * tu + vertex2->tangent.u * tv;
+        isectShape->tangent.v = vertex0->tangent.v * (1 - tu - tv) + vertex1->tangent.v * tu + vertex2->tangent.v * tv;
+        isectShape->surfacePoint = pntSurf0 * (1 - tu - tv) + pntSurf1 * tu + pntSurf2 * tv;
+        ret = true;
+        if(!closest) {
+            return true;
         }
-    } while(n > 0);
+    }
+    if(Triangle_intersect(ray, vertex3->point, vertex2->point, vertex1->point, &isectShape->distance, &tu, &tv)) {
+        isectShape->normal = vertex3->normal * (1 - tu - tv) + vertex2->normal * tu + vertex1->normal * tv;
+        isectShape->tangent.u = vertex3->tangent.u * (1 - tu - tv) + vertex2->tangent.u * tu + vertex1->tangent.u * tv;
+        isectShape->tangent.v = vertex3->tangent.v * (1 - tu - tv) + vertex2->tangent.v * tu + vertex1->tangent.v * tv;
+        isectShape->surfacePoint = pntSurf3 * (1 - tu - tv) + pntSurf2 * tu + pntSurf1 * tv;
+        ret = true;
+    }
 
     return ret;
 }
 
 bool ShapeGrid_intersect(Ray *ray, ShapeGrid *grid, ShapeIntersection *isectShape, bool closest)
 {
-    StackEntry stack[64];
-
     bool ret = false;
-    int n = 0;
-    stack[n].nodeIndex = 0;
-    stack[n].minDistance = 0;
-    n++;
-
-    do {
-        n--;
-        int nodeIndex = stack[n].nodeIndex;
-        BVHNode *bvhNode = &grid->bvh[nodeIndex];
-        float nodeMinimum = stack[n].minDistance;
+    int nodeIndex = 0;
 
-        if(nodeMinimum > isectShape->distance) {
-            continue;
-        }
+    while(nodeIndex != -1) {
+        BVHNode *bvhNode = &grid->bvh[nodeIndex];
 
-        if(bvhNode->index <= 0) {
-            int index = -bvhNode->index;
-            unsigned int u = index % grid->width;
-            unsigned int v = index / grid->width;
-            GridVertex *vertex0 = &grid->vertices[v * grid->width + u];
-            Point2D pntSurf0 = (Point2D)((float)u / grid->width, (float)v / grid->height);
-            GridVertex *vertex1 = &grid->vertices[v * grid->width + u + 1];
-            Point2D pntSurf1 = (Point2D)((float)(u + 1) / grid->width, (float)v / grid->height);
-            GridVertex *vertex2 = &grid->vertices[(v + 1) * grid->width + u];
-            Point2D pntSurf2 = (Point2D)((float)u / grid->width, (float)(v + 1) / grid->height);
-            GridVertex *vertex3 = &grid->vertices[(v + 1) * grid->width + u + 1];
-            Point2D pntSurf3 = (Point2D)((float)(u + 1) / grid->width, (float)(v + 1) / grid->height);
-
-            float tu, tv;
-            if(Triangle_intersect(ray, vertex0->point, vertex1->point, vertex2->point, &isectShape->distance, &tu, &tv)) {
-                isectShape->normal = vertex0->normal * (1 - tu - tv) + vertex1->normal * tu + vertex2->normal * tv;
-                isectShape->tangent.u = vertex0->tangent.u * (1 - tu - tv) + vertex1->tangent.u * tu + vertex2->tangent.u * tv;
-                isectShape->tangent.v = vertex0->tangent.v * (1 - tu - tv) + vertex1->tangent.v * tu + vertex2->tangent.v * tv;
-                isectShape->surfacePoint = pntSurf0 * (1 - tu - tv) + pntSurf1 * tu + pntSurf2 * tv;
-                ret = true;
-                if(!closest) {
-                    break;
-                }
-            }
-            if(Triangle_intersect(ray, vertex3->point, vertex2->point, vertex1->point, &isectShape->distance, &tu, &tv)) {
-                isectShape->normal = vertex3->normal * (1 - tu - tv) + vertex2->normal * tu + vertex1->normal * tv;
-                isectShape->tangent.u = vertex3->tangent.u * (1 - tu - tv) + vertex2->tangent.u * tu + vertex1->tangent.u * tv;
-                isectShape->tangent.v = vertex3->tangent.v * (1 - tu - tv) + vertex2->tangent.v * tu + vertex1->tangent.v * tv;
-                isectShape->surfacePoint = pntSurf3 * (1 - tu - tv) + pntSurf2 * tu + pntSurf1 * tv;
+        if(!BVHNode_intersect(bvhNode, ray, isectShape->distance)) {
+            nodeIndex = bvhNode->escape;
+        } else if(bvhNode->index <= 0) {
+            if(ShapeGrid_intersectCell(ray, grid, -bvhNode->index, isectShape, closest)) {
                 ret = true;
                 if(!closest) {
                     break;
                 }
             }
+            nodeIndex = bvhNode->escape;
         } else {
-            int indices[2] = { nodeIndex + 1, bvhNode->index };
-            float minDistances[2];
-            float maxDistances[2];
-            for(int i=0; i<2; i++) {
-                minDistances[i] = MAXFLOAT;
-                maxDistances[i] = -MAXFLOAT;
-                BoundingVolume_intersect(&bvhNode->volume, ray, &minDistances[i], &maxDistances[i]);
-            }
-
-            for(int i=0; i<2; i++) {
-                int j = (minDistances[0] >= minDistances[1]) ? i : 1 - i;
-                if(maxDistances[j] > 0) {
-                    stack[n].nodeIndex = indices[j];
-                    stack[n].minDistance = minDistances[j];
-                    n++;
-                }
-            }
+            nodeIndex++;
         }
-    } while(n > 0);
+    }
 
     return ret;
 }
@@ -444,17 +414,27 @@ bool Shape_intersect_2(Ray *ray, Shape *shape, ShapeIntersection *isectShape, bo
     }
 }
 
+void ShapeTransformed_transformRay(ShapeTransformed *transformed, Ray *ray, Ray *rayTrans)
+{
+    rayTrans->origin = Matrix_multiplyPoint(&transformed->transformation.inverseMatrix, &ray->origin);
+    rayTrans->direction = Matrix_multiplyVector(&transformed->transformation.inverseMatrix, &ray->direction);
+}
+
+void ShapeTransformed_transformIntersection(ShapeTransformed *transformed, ShapeIntersection *isectShape)
+{
+    isectShape->normal = normalize(Matrix_multiplyNormal(&transformed->transformation.matrix, &isectShape->normal));
+    isectShape->tangent.u = Matrix_multiplyVector(&transformed->transformation.matrix, &isectShape->tangent.u);
+    isectShape->tangent.v = Matrix_multiplyVector(&transformed->transformation.matrix, &isectShape->tangent.v);
+}
+
 bool ShapeTransformed_intersect(Ray *ray, ShapeTransformed *transformed, ShapeIntersection *isectShape, bool closest)
 {
     Ray rayTrans;
-    rayTrans.origin = Matrix_multiplyPoint(&transformed->transformation.inverseMatrix, &ray->origin);
-    rayTrans.direction = Matrix_multiplyVector(&transformed->transformation.inverseMatrix, &ray->direction);
+    ShapeTransformed_transformRay(transformed, ray, &rayTrans);
     
     bool ret = false;
     if(Shape_intersect_2(&rayTrans, transformed->shape, isectShape, closest)) {
-        isectShape->normal = normalize(Matrix_multiplyNormal(&transformed->transformation.matrix, &isectShape->normal));
-        isectShape->tangent.u = Matrix_multiplyVector(&transformed->transformation.matrix, &isectShape->tangent.u);
-        isectShape->tangent.v = Matrix_multiplyVector(&transformed->transformation.matrix, &isectShape->tangent.v);
+        ShapeTransformed_transformIntersection(transformed, isectShape);
         ret = true;
     }
 
@@ -15,6 +15,7 @@ struct BoundingVolumeProxy {
 struct BVHNodeProxy {
     BoundingVolumeProxy volume;
     int index;
+    int escape;
 };
 
 struct ShapeQuadProxy {
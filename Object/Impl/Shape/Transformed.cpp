@@ -30,4 +30,9 @@ namespace Object::Impl::Shape {
         proxy.transformed.shape = clAllocator.allocate<ShapeProxy>();
         mShape->writeProxy(*proxy.transformed.shape, clAllocator);
     }
+
+    const Object::Shape &Transformed::shape() const
+    {
+        return *mShape;
+    }
 }
\ No newline at end of file
@@ -18,6 +18,8 @@ namespace Object::Impl::Shape {
 
         void writeProxy(ShapeProxy &proxy, OpenCL::Allocator &clAllocator) const override;
 
+        const Object::Shape &shape() const;
+
     private:
         std::unique_ptr<Object::Shape> mShape;
         Math::Transformation mTransformation;
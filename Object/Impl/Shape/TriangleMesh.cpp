@@ -1,6 +1,8 @@
 #include "Object/Impl/Shape/TriangleMesh.hpp"
 #include "Object/Impl/Shape/Triangle.hpp"
 
+#include "Stats.hpp"
+
 #include <algorithm>
 
 namespace Object::Impl::Shape {
@@ -21,6 +23,7 @@ namespace Object::Impl::Shape {
         auto callback = [&](unsigned int index, float &) {
             const Triangle &triangle = mTriangles[index];
             bool ret = false;
+            Stats::count(Stats::Counter::TrianglesTested);
 
             const Vertex &vertex0 = mVertices[triangle.vertices[0]];
             const Vertex &vertex1 = mVertices[triangle.vertices[1]];
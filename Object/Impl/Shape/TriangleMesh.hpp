@@ -30,12 +30,11 @@ namespace Object::Impl::Shape {
         BoundingVolume boundingVolume(const Math::Transformation &trans) const override;
 
         const Object::BoundingVolumeHierarchy &boundingVolumeHierarchy() const;
+        Object::BoundingVolumeHierarchy computeBoundingVolumeHierarchy() const;
 
         void writeProxy(ShapeProxy &proxy, OpenCL::Allocator &clAllocator) const override;
 
     private:
-        Object::BoundingVolumeHierarchy computeBoundingVolumeHierarchy() const;
-
         std::vector<Vertex> mVertices;
         std::vector<Triangle> mTriangles;
         Object::BoundingVolumeHierarchy mBoundingVolumeHierarchy;
@@ -20,6 +20,19 @@ namespace Object {
         mSurfaceProjectionValid = false;
     };
 
+    Intersection::Intersection(const Object::Scene &scene, const Object::Primitive &primitive, const Math::Beam &beam, const Math::Point &point, const Math::Normal &normal, const Math::Color &albedo)
+        : mScene(&scene), mPrimitive(&primitive), mBeam(&beam), mPoint(point)
+    {
+        mShapeIntersection.distance = (point - mBeam->ray().origin()).magnitude();
+        mShapeIntersection.normal = normal;
+        mNormal = normal;
+        mFacingNormal = (mNormal * -mBeam->ray().direction() > 0) ? mNormal : -mNormal;
+        mNormalValid = true;
+        mAlbedo = albedo;
+        mAlbedoValid = true;
+        mSurfaceProjectionValid = false;
+    }
+
     const Math::Point &Intersection::point() const
     {
         return mPoint;
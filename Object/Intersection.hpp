@@ -20,6 +20,7 @@ namespace Object {
     public:
         Intersection();
         Intersection(const Object::Scene &scene, const Object::Primitive &primitive, const Math::Beam &beam, const Object::Shape::Intersection &shapeIntersection);
+        Intersection(const Object::Scene &scene, const Object::Primitive &primitive, const Math::Beam &beam, const Math::Point &point, const Math::Normal &normal, const Math::Color &albedo);
 
         bool valid() const;
 
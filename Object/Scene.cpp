@@ -12,6 +12,8 @@
 #include "Object/Impl/Light/Point.hpp"
 #include "Object/Impl/Light/Sky.hpp"
 
+#include "Stats.hpp"
+
 #include <cfloat>
 
 namespace Object {
@@ -89,7 +91,10 @@ namespace Object {
         shapeIntersection.distance = maxDistance;
         Object::Primitive *primitive = 0;
 
+        Stats::count(closest ? Stats::Counter::ClosestHitRays : Stats::Counter::AnyHitRays);
+
         auto func = [&](int index, float &maxDistance) {
+            Stats::count(Stats::Counter::PrimitivesTested);
             if (mPrimitives[index]->shape().intersect(beam.ray(), shapeIntersection, closest)) {
                 primitive = mPrimitives[index].get();
                 maxDistance = shapeIntersection.distance;
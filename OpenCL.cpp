@@ -2,47 +2,177 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <filesystem>
+#include <random>
+#include <stdexcept>
 
 namespace OpenCL {
-    Context::Context()
+    Context::Context(const std::string &device)
     {
-        cl_uint num_platforms;
+        std::vector<Device> devices = Context::devices();
+        for(unsigned int i = 0; i < devices.size(); i++) {
+            const char *type = (devices[i].type & CL_DEVICE_TYPE_GPU) ? "GPU" : (devices[i].type & CL_DEVICE_TYPE_CPU) ? "CPU" : "Other";
+            printf("Device %i: %s [%s]%s\n", i, devices[i].name.c_str(), type, devices[i].svm ? "" : " (no SVM)");
+        }
 
-        clGetPlatformIDs(1, &mClPlatform, &num_platforms);
-        printf("Found %i platforms\n", num_platforms);
-        
-        cl_uint num_devices;
-        clGetDeviceIDs(mClPlatform, CL_DEVICE_TYPE_GPU, 1, &mClDevice, &num_devices);
-        printf("Found %i devices\n", num_devices);
+        const Device *selected = selectDevice(devices, device);
+        if(!selected) {
+            throw std::runtime_error("No OpenCL device matching \"" + device + "\"");
+        }
+        if(!selected->svm) {
+            throw std::runtime_error("OpenCL device " + selected->name + " does not support coarse-grained SVM buffers");
+        }
 
-        cl_int errcode;
+        mDeviceName = selected->name;
+        mDeviceType = selected->type;
+        mClPlatform = selected->platform;
+        mClDevice = selected->device;
+        printf("Using device: %s\n", mDeviceName.c_str());
 
-        cl_device_svm_capabilities svm_caps;
-        errcode = clGetDeviceInfo(mClDevice, CL_DEVICE_SVM_CAPABILITIES, sizeof(svm_caps), &svm_caps, NULL);
-        printf("Get device caps: %llx errcode: %i\n", svm_caps, errcode);
+        cl_int errcode;
 
         cl_context_properties context_properties[] = {
             CL_CONTEXT_PLATFORM, (cl_context_properties)mClPlatform,
             0
         };
         mClContext = clCreateContext(context_properties, 1, &mClDevice, NULL, NULL, &errcode);
-        printf("Context: %p errcode: %i\n", mClContext, errcode);
+        if(errcode != CL_SUCCESS) {
+            throw std::runtime_error("Failed to create OpenCL context: " + std::to_string(errcode));
+        }
 
         mClHostQueue = clCreateCommandQueueWithProperties(mClContext, mClDevice, NULL, &errcode);
-        printf("Command queue: %p errcode: %i\n", mClHostQueue, errcode);
+        if(errcode != CL_SUCCESS) {
+            clReleaseContext(mClContext);
+            throw std::runtime_error("Failed to create OpenCL command queue: " + std::to_string(errcode));
+        }
 
-        cl_queue_properties properties[] = {
-            CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_ON_DEVICE | CL_QUEUE_ON_DEVICE_DEFAULT,
-            (cl_queue_properties)0
-        };
-        mClDeviceQueue = clCreateCommandQueueWithProperties(mClContext, mClDevice, properties, &errcode);
-        printf("Command queue: %p errcode: %i\n", mClDeviceQueue, errcode);
+        mClDeviceQueue = NULL;
+        cl_device_device_enqueue_capabilities enqueueCaps = 0;
+        clGetDeviceInfo(mClDevice, CL_DEVICE_DEVICE_ENQUEUE_CAPABILITIES, sizeof(enqueueCaps), &enqueueCaps, NULL);
+        if(enqueueCaps & CL_DEVICE_QUEUE_SUPPORTED) {
+            cl_queue_properties properties[] = {
+                CL_QUEUE_PROPERTIES, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_ON_DEVICE | CL_QUEUE_ON_DEVICE_DEFAULT,
+                (cl_queue_properties)0
+            };
+            mClDeviceQueue = clCreateCommandQueueWithProperties(mClContext, mClDevice, properties, &errcode);
+            if(errcode != CL_SUCCESS) {
+                mClDeviceQueue = NULL;
+            }
+        }
     }
 
     Context::~Context()
     {
+        if(mClDeviceQueue) {
+            clReleaseCommandQueue(mClDeviceQueue);
+        }
+        clReleaseCommandQueue(mClHostQueue);
+        clReleaseContext(mClContext);
+    }
+
+    std::vector<Device> Context::devices()
+    {
+        std::vector<Device> devices;
+
+        cl_uint numPlatforms = 0;
+        if(clGetPlatformIDs(0, NULL, &numPlatforms) != CL_SUCCESS || numPlatforms == 0) {
+            return devices;
+        }
+        std::vector<cl_platform_id> platforms(numPlatforms);
+        clGetPlatformIDs(numPlatforms, &platforms[0], NULL);
+
+        for(cl_platform_id platform : platforms) {
+            cl_uint numDevices = 0;
+            if(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices) != CL_SUCCESS || numDevices == 0) {
+                continue;
+            }
+            std::vector<cl_device_id> deviceIds(numDevices);
+            clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, &deviceIds[0], NULL);
+
+            for(cl_device_id deviceId : deviceIds) {
+                Device device;
+                device.platform = platform;
+                device.device = deviceId;
+                device.type = 0;
+                clGetDeviceInfo(deviceId, CL_DEVICE_TYPE, sizeof(device.type), &device.type, NULL);
+
+                char name[256] = "";
+                clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+                device.name = name;
+
+                cl_device_svm_capabilities svmCaps = 0;
+                clGetDeviceInfo(deviceId, CL_DEVICE_SVM_CAPABILITIES, sizeof(svmCaps), &svmCaps, NULL);
+                device.svm = (svmCaps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) != 0;
+
+                devices.push_back(device);
+            }
+        }
+
+        return devices;
+    }
+
+    const Device *Context::selectDevice(const std::vector<Device> &devices, const std::string &selector)
+    {
+        std::string lower = selector;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        if(lower.empty() || lower == "default") {
+            const cl_device_type types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU, CL_DEVICE_TYPE_ALL };
+            for(cl_device_type type : types) {
+                for(const Device &device : devices) {
+                    if((device.type & type) && device.svm) {
+                        return &device;
+                    }
+                }
+            }
+            return devices.empty() ? nullptr : &devices[0];
+        }
+
+        if(lower == "gpu" || lower == "cpu" || lower == "accelerator") {
+            cl_device_type type = (lower == "gpu") ? CL_DEVICE_TYPE_GPU : (lower == "cpu") ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_ACCELERATOR;
+            const Device *match = nullptr;
+            for(const Device &device : devices) {
+                if(device.type & type) {
+                    if(device.svm) {
+                        return &device;
+                    }
+                    if(!match) {
+                        match = &device;
+                    }
+                }
+            }
+            return match;
+        }
+
+        if(std::all_of(lower.begin(), lower.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            size_t index = std::stoul(lower);
+            return index < devices.size() ? &devices[index] : nullptr;
+        }
+
+        for(const Device &device : devices) {
+            std::string name = device.name;
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            if(name.find(lower) != std::string::npos) {
+                return &device;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const std::string &Context::deviceName()
+    {
+        return mDeviceName;
+    }
+
+    bool Context::cpuDevice()
+    {
+        return (mDeviceType & CL_DEVICE_TYPE_CPU) != 0;
     }
 
     cl_platform_id Context::clPlatform()
@@ -73,63 +203,154 @@ namespace OpenCL {
     Program::Program(Context &context, const std::vector<std::string> &filenames)
     {
         std::vector<std::string> sourceStrs;
-        std::vector<const char *> sources;
-        std::vector<size_t> sizes;
-        std::filesystem::file_time_type cacheTime;
-        bool useCache = false;
+        for(const std::string &filename : filenames) {
+            sourceStrs.push_back(loadSourceFile(filename));
+            if(sourceStrs.back().empty()) {
+                printf("Failed to load %s\n", filename.c_str());
+            }
+        }
 
-        std::filesystem::path cachePath("clcache.bin");
-        if(std::filesystem::exists(cachePath)) {
-            useCache = true;
-            cacheTime = std::filesystem::last_write_time(cachePath);
+        std::filesystem::path cachePath = cacheDirectory() / (cacheKey(context, filenames, sourceStrs) + ".bin");
+        if(std::filesystem::exists(cachePath) && buildFromBinary(context, loadSourceFile(cachePath.string()))) {
+            return;
         }
 
-        for(const std::string &filename : filenames) {
-            std::string sourceStr = loadSourceFile(filename);
+        std::vector<const char *> sources;
+        std::vector<size_t> sizes;
+        for(const std::string &sourceStr : sourceStrs) {
             sources.push_back(sourceStr.c_str());
             sizes.push_back(sourceStr.size());
-            sourceStrs.push_back(std::move(sourceStr));
-            std::filesystem::file_time_type time = std::filesystem::last_write_time(filename);
-            if(time > cacheTime) {
-                useCache = false;
+        }
+
+        cl_int errcode;
+        mClProgram = clCreateProgramWithSource(context.clContext(), sourceStrs.size(), &sources[0], &sizes[0], &errcode);
+        printf("Program: %p errcode: %i\n", mClProgram, errcode);
+
+        errcode = clBuildProgram(mClProgram, 0, NULL, kBuildOptions, NULL, NULL);
+        printf("Build program: %i\n", errcode);
+
+        char buffer[1024*100];
+        size_t logSize = 0;
+        clGetProgramBuildInfo(mClProgram, context.clDevice(), CL_PROGRAM_BUILD_LOG, sizeof(buffer) - 1, buffer, &logSize);
+        buffer[std::min(logSize, sizeof(buffer) - 1)] = '\0';
+        printf("%s\n", buffer);
+
+        if(errcode == CL_SUCCESS) {
+            writeCache(cachePath);
+        }
+    }
+
+    const char *Program::kBuildOptions = "-cl-std=CL2.0";
+
+    std::filesystem::path Program::cacheDirectory()
+    {
+        const char *directory = std::getenv("RAYTRACE_CL_CACHE");
+        return std::filesystem::path((directory && *directory) ? directory : "clcache");
+    }
+
+    std::string Program::cacheKey(Context &context, const std::vector<std::string> &filenames, const std::vector<std::string> &sourceStrs)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto addBytes = [&](const void *data, size_t size) {
+            const unsigned char *bytes = (const unsigned char*)data;
+            for(size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
             }
+            hash = (hash ^ 0xff) * 1099511628211ull;
+        };
+        auto addString = [&](const std::string &string) {
+            addBytes(string.data(), string.size());
+        };
+        auto addDeviceInfo = [&](cl_device_info info) {
+            char value[1024] = "";
+            clGetDeviceInfo(context.clDevice(), info, sizeof(value) - 1, value, NULL);
+            addString(value);
+        };
+        auto addPlatformInfo = [&](cl_platform_info info) {
+            char value[1024] = "";
+            clGetPlatformInfo(context.clPlatform(), info, sizeof(value) - 1, value, NULL);
+            addString(value);
+        };
+
+        addPlatformInfo(CL_PLATFORM_NAME);
+        addPlatformInfo(CL_PLATFORM_VERSION);
+        addDeviceInfo(CL_DEVICE_NAME);
+        addDeviceInfo(CL_DEVICE_VERSION);
+        addDeviceInfo(CL_DRIVER_VERSION);
+        addString(kBuildOptions);
+        for(size_t i = 0; i < filenames.size(); i++) {
+            addString(filenames[i]);
+            addString(sourceStrs[i]);
         }
-        
-        if(useCache) {
-            std::string binStr = loadSourceFile(cachePath.string());
-            cl_device_id device = context.clDevice();
-            size_t length = binStr.size();
-            const unsigned char *binary = (const unsigned char*)&binStr[0];
-            cl_int errcode;
-            mClProgram = clCreateProgramWithBinary(context.clContext(), 1, &device, &length, &binary, NULL, &errcode);
-            printf("Program: %p errcode: %i\n", mClProgram, errcode);
-
-            errcode = clBuildProgram(mClProgram, 0, NULL, "-cl-std=CL2.0", NULL, NULL);
-            printf("Build program: %i\n", errcode);
-        } else {
-            cl_int errcode;
-            mClProgram = clCreateProgramWithSource(context.clContext(), sourceStrs.size(), &sources[0], &sizes[0], &errcode);
-            printf("Program: %p errcode: %i\n", mClProgram, errcode);
-
-            errcode = clBuildProgram(mClProgram, 0, NULL, "-cl-std=CL2.0", NULL, NULL);
-            printf("Build program: %i\n", errcode);
-
-            char buffer[1024*100];
-            size_t logSize = 0;
-            clGetProgramBuildInfo(mClProgram, context.clDevice(), CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &logSize);
-            buffer[logSize] = '\0';
-            printf("%s\n", buffer);
-
-            size_t binSize;
-            clGetProgramInfo(mClProgram, CL_PROGRAM_BINARY_SIZES, sizeof(binSize), &binSize, NULL);
-            unsigned char *binary = new unsigned char[binSize];
-            clGetProgramInfo(mClProgram, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, NULL);
-            std::ofstream of(cachePath.string().c_str(), std::ios::out | std::ios::binary);
-            of.write((const char*)binary, binSize);
-            of.close();
-        }
-    }
-    
+
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+        return key;
+    }
+
+    bool Program::buildFromBinary(Context &context, const std::string &binStr)
+    {
+        if(binStr.empty()) {
+            return false;
+        }
+
+        cl_device_id device = context.clDevice();
+        size_t length = binStr.size();
+        const unsigned char *binary = (const unsigned char*)&binStr[0];
+        cl_int binaryStatus;
+        cl_int errcode;
+        mClProgram = clCreateProgramWithBinary(context.clContext(), 1, &device, &length, &binary, &binaryStatus, &errcode);
+        if(errcode != CL_SUCCESS || binaryStatus != CL_SUCCESS) {
+            printf("Cached program rejected: %i\n", errcode != CL_SUCCESS ? errcode : binaryStatus);
+            if(errcode == CL_SUCCESS) {
+                clReleaseProgram(mClProgram);
+            }
+            return false;
+        }
+
+        errcode = clBuildProgram(mClProgram, 0, NULL, kBuildOptions, NULL, NULL);
+        if(errcode != CL_SUCCESS) {
+            printf("Cached program build failed: %i\n", errcode);
+            clReleaseProgram(mClProgram);
+            return false;
+        }
+
+        printf("Program loaded from cache\n");
+        return true;
+    }
+
+    void Program::writeCache(const std::filesystem::path &cachePath)
+    {
+        size_t binSize = 0;
+        clGetProgramInfo(mClProgram, CL_PROGRAM_BINARY_SIZES, sizeof(binSize), &binSize, NULL);
+        if(binSize == 0) {
+            return;
+        }
+
+        std::vector<unsigned char> binary(binSize);
+        unsigned char *binaryPtr = &binary[0];
+        clGetProgramInfo(mClProgram, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binaryPtr, NULL);
+
+        std::error_code error;
+        std::filesystem::create_directories(cachePath.parent_path(), error);
+
+        std::filesystem::path tempPath = cachePath;
+        tempPath += "." + std::to_string(std::random_device()()) + ".tmp";
+        std::ofstream of(tempPath.string().c_str(), std::ios::out | std::ios::binary);
+        of.write((const char*)&binary[0], binSize);
+        of.close();
+
+        if(!of.good()) {
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+
+        std::filesystem::rename(tempPath, cachePath, error);
+        if(error) {
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
     std::string Program::loadSourceFile(const std::string &filename)
     {
         std::string ret;
@@ -174,11 +395,15 @@ namespace OpenCL {
             areas.push_back(area);
         }
         cl_int errcode = clSetKernelExecInfo(mClKernel, CL_KERNEL_EXEC_INFO_SVM_PTRS, areas.size() * sizeof(void*), &areas[0]);
-        printf("Set exec info: %i\n", errcode);
+        if(errcode != CL_SUCCESS) {
+            printf("Set exec info: %i\n", errcode);
+        }
 
         size_t global_size = size;
         errcode = clEnqueueNDRangeKernel(context.clQueue(), mClKernel, 1, NULL, &global_size, NULL, 0, NULL, NULL);
-        printf("Enqueue kernel: %i\n", errcode);
+        if(errcode != CL_SUCCESS) {
+            printf("Enqueue kernel: %i\n", errcode);
+        }
     }
 
     static const int kAreaSize = 1024*1024*1;
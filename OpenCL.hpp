@@ -4,21 +4,39 @@
 #define CL_TARGET_OPENCL_VERSION 300
 #include <CL/cl.h>
 
+#include <filesystem>
 #include <string>
 #include <vector>
 
 namespace OpenCL {
+    struct Device {
+        cl_platform_id platform;
+        cl_device_id device;
+        cl_device_type type;
+        std::string name;
+        bool svm;
+    };
+
     class Context {
     public:
-        Context();
+        Context(const std::string &device = "");
         ~Context();
 
+        static std::vector<Device> devices();
+
+        const std::string &deviceName();
+        bool cpuDevice();
+
         cl_platform_id clPlatform();
         cl_device_id clDevice();
         cl_context clContext();
         cl_command_queue clQueue();
 
     private:
+        static const Device *selectDevice(const std::vector<Device> &devices, const std::string &selector);
+
+        std::string mDeviceName;
+        cl_device_type mDeviceType;
         cl_platform_id mClPlatform;
         cl_device_id mClDevice;
         cl_context mClContext;
@@ -34,7 +52,14 @@ namespace OpenCL {
         cl_program &clProgram();
 
     private:
+        static const char *kBuildOptions;
+
+        static std::filesystem::path cacheDirectory();
+        static std::string cacheKey(Context &context, const std::vector<std::string> &filenames, const std::vector<std::string> &sourceStrs);
+
         std::string loadSourceFile(const std::string &filename);
+        bool buildFromBinary(Context &context, const std::string &binStr);
+        void writeCache(const std::filesystem::path &cachePath);
 
         cl_program mClProgram;
     };
@@ -1,5 +1,7 @@
 #include "Render/Cpu/Executor.hpp"
 
+#include "Stats.hpp"
+
 #include <windows.h>
 
 namespace Render::Cpu {
@@ -20,7 +22,10 @@ namespace Render::Cpu {
 
     Executor::~Executor()
     {
-        mRunThreads = false;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mRunThreads = false;
+        }
         mCondVar.notify_all();
         for(std::unique_ptr<std::thread> &thread : mThreads) {
             thread->join();
@@ -54,11 +59,8 @@ namespace Render::Cpu {
         while(true) {
             {
                 std::unique_lock<std::mutex> lock(mMutex);
-                while(!mCurrentJob || !mRunJob) {
+                while(mRunThreads && (!mCurrentJob || !mRunJob)) {
                     mCondVar.wait(lock);
-                    if(!mRunThreads) {
-                        break;
-                    }
                 }
                 mNumRunningThreads++;
             }
@@ -74,6 +76,7 @@ namespace Render::Cpu {
                     jobDone = true;
                 }
             }
+            Stats::flush();
 
             std::unique_lock<std::mutex> lock(mMutex);
             if(!mRunThreads) {
@@ -3,14 +3,20 @@
 #include "Render/Cpu/RasterJob.hpp"
 
 #include "Object/Scene.hpp"
+#include "Object/Impl/Light/Point.hpp"
 
 #include "Math/OrthonormalBasis.hpp"
 #include "Math/Impl/Sampler/Random.hpp"
 
+#include "Stats.hpp"
+
 #include <cmath>
 #include <cfloat>
-#include <functional>
 #include <mutex>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
 namespace Render::Cpu::Impl::Lighter {
     class RadianceGradient
@@ -60,12 +66,42 @@ namespace Render::Cpu::Impl::Lighter {
             return RadianceGradient(mRed / other, mGreen / other, mBlue / other);
         }
 
+        float magnitude() const
+        {
+            return std::sqrt(mRed.magnitude2() + mGreen.magnitude2() + mBlue.magnitude2());
+        }
+
     private:
         Math::Vector mRed;
         Math::Vector mGreen;
         Math::Vector mBlue;
     };
 
+    static const unsigned int kMinPilotSamples = 64;
+    static const float kMaxRelativeError = 0.1f;
+    static const int kCoarsestStride = 8;
+    static const unsigned int kFlatStackSize = 256;
+
+    static float relativeError(const std::vector<Math::Radiance> &samples)
+    {
+        float sum = 0;
+        float sum2 = 0;
+        for (const Math::Radiance &sample : samples) {
+            float magnitude = sample.magnitude();
+            sum += magnitude;
+            sum2 += magnitude * magnitude;
+        }
+
+        float n = static_cast<float>(samples.size());
+        float mean = sum / n;
+        if (mean <= 0) {
+            return 0;
+        }
+
+        float variance = std::max(0.0f, sum2 / n - mean * mean);
+        return std::sqrt(variance / n) / mean;
+    }
+
     class IrradianceCached::Cache
     {
     public:
@@ -80,8 +116,9 @@ namespace Render::Cpu::Impl::Lighter {
 
         Cache(float threshold);
         float threshold() const;
+        void setView(const Object::Camera &camera, unsigned int width);
 
-        float weight(const Entry &entry, const Math::Point &point, const Math::Normal &normal) const;
+        float weight(const Math::Point &entryPoint, const Math::Normal &entryNormal, float entryRadius, const Math::Point &point, const Math::Normal &normal) const;
         float error(const Entry &entry, const Math::Point &point, const Math::Normal &normal) const;
         bool test(const Math::Point &point, const Math::Normal &normal) const;
         bool testUnlocked(const Math::Point &point, const Math::Normal &normal) const;
@@ -89,6 +126,10 @@ namespace Render::Cpu::Impl::Lighter {
         Math::Radiance interpolateUnlocked(const Math::Point &point, const Math::Normal &normal) const;
         void add(const Entry &entry);
         void clear();
+        void freeze();
+
+        bool load(const std::string &filename, uint64_t key, std::string &error);
+        void save(const std::string &filename, uint64_t key) const;
 
     private:
         struct OctreeNode
@@ -97,23 +138,56 @@ namespace Render::Cpu::Impl::Lighter {
             std::unique_ptr<OctreeNode> children[8];
         };
 
-        bool visitOctreeNode(OctreeNode *node, const Math::Point &origin, float size, const Math::Point &point, const std::function<bool(const Entry &)> &callback) const;
+        struct FlatNode
+        {
+            Math::Point origin;
+            float size;
+            unsigned int firstChild;
+            unsigned int numChildren;
+            unsigned int firstEntry;
+            unsigned int numEntries;
+        };
+
+        struct EntryPayload
+        {
+            Math::Radiance radiance;
+            RadianceGradient rotGrad;
+            RadianceGradient transGrad;
+        };
+
+        template<typename Callback> bool visitOctreeNode(OctreeNode *node, const Math::Point &origin, float size, const Math::Point &point, Callback &callback) const;
+        template<typename Callback> void visitFlatNodes(const Math::Point &point, Callback &callback) const;
+        void collectEntries(const OctreeNode *node, std::vector<Entry> &entries) const;
 
-        float distance2ToNode(const Math::Point &point, int idx, const Math::Point &origin, float size) const;
+        float minRadius(const Math::Point &point) const;
+        float lookupRadius(const Entry &entry) const;
+        float distance2ToNode(const Math::Point &point, const Math::Point &origin, float size) const;
         void getChildNode(const Math::Point &origin, float size, int idx, Math::Point &childOrigin, float &childSize) const;
-        bool isEntryValid(const Entry &entry, const Math::Point &point, const Math::Normal &normal, float weight, float threshold) const;
+        bool isEntryValid(const Math::Point &entryPoint, const Math::Normal &entryNormal, const Math::Point &point, const Math::Normal &normal, float weight, float threshold) const;
 
         std::unique_ptr<OctreeNode> mOctreeRoot;
         Math::Point mOctreeOrigin;
         float mOctreeSize;
         mutable std::mutex mMutex;
         float mThreshold;
+        const Object::Camera *mCamera;
+        float mPixelSize;
+
+        std::vector<FlatNode> mFlatNodes;
+        std::vector<Math::Point> mFlatPoints;
+        std::vector<Math::Normal> mFlatNormals;
+        std::vector<float> mFlatRadii;
+        std::vector<EntryPayload> mFlatPayloads;
+        unsigned int mFlatStackSize;
     };
 
     IrradianceCached::Cache::Cache(float threshold)
     {
         mOctreeSize = 0;
         mThreshold = threshold;
+        mCamera = nullptr;
+        mPixelSize = 0;
+        mFlatStackSize = 0;
     }
 
     float IrradianceCached::Cache::threshold() const
@@ -121,10 +195,29 @@ namespace Render::Cpu::Impl::Lighter {
         return mThreshold;
     }
 
-    float IrradianceCached::Cache::weight(const Entry &entry, const Math::Point &point, const Math::Normal &normal) const 
+    void IrradianceCached::Cache::setView(const Object::Camera &camera, unsigned int width)
     {
-        //return std::pow(std::max(double(0), 1.0f - (point - entry.point).magnitude2() / (1.0 * entry.radius * std::pow(normal * entry.normal, 4.0f))), 2);
-        return 1.0f / ((point - entry.point).magnitude() / entry.radius + std::sqrt(1 - std::min(1.0f, normal * entry.normal)));
+        mCamera = &camera;
+        mPixelSize = 2.0f / width;
+    }
+
+    float IrradianceCached::Cache::minRadius(const Math::Point &point) const
+    {
+        float projectedPixelSize = mCamera->projectSize(mPixelSize, (point - mCamera->position()).magnitude());
+        return 3 * projectedPixelSize / mThreshold;
+    }
+
+    float IrradianceCached::Cache::lookupRadius(const Entry &entry) const
+    {
+        // Entries keep their world-space radius; the pixel-size clamp depends on the current view
+        float minR = minRadius(entry.point);
+        return std::min(std::max(entry.radius, minR), 20 * minR);
+    }
+
+    float IrradianceCached::Cache::weight(const Math::Point &entryPoint, const Math::Normal &entryNormal, float entryRadius, const Math::Point &point, const Math::Normal &normal) const 
+    {
+        //return std::pow(std::max(double(0), 1.0f - (point - entryPoint).magnitude2() / (1.0 * entryRadius * std::pow(normal * entryNormal, 4.0f))), 2);
+        return 1.0f / ((point - entryPoint).magnitude() / entryRadius + std::sqrt(1 - std::min(1.0f, normal * entryNormal)));
     }
 
     float IrradianceCached::Cache::error(const Entry &entry, const Math::Point &point, const Math::Normal &normal) const
@@ -132,7 +225,7 @@ namespace Render::Cpu::Impl::Lighter {
         return ((4.0f / M_PI) * (point - entry.point).magnitude() / entry.radius + std::sqrt(1 - normal * entry.normal));
     }
 
-    float IrradianceCached::Cache::distance2ToNode(const Math::Point &point, int idx, const Math::Point &origin, float size) const
+    float IrradianceCached::Cache::distance2ToNode(const Math::Point &point, const Math::Point &origin, float size) const
     {
         float distance2 = 0;
         float d;
@@ -157,13 +250,13 @@ namespace Render::Cpu::Impl::Lighter {
         childOrigin = origin + Math::Vector(x, y, z) * childSize;
     }
 
-    bool IrradianceCached::Cache::isEntryValid(const Entry &entry, const Math::Point &point, const Math::Normal &normal, float weight, float threshold) const
+    bool IrradianceCached::Cache::isEntryValid(const Math::Point &entryPoint, const Math::Normal &entryNormal, const Math::Point &point, const Math::Normal &normal, float weight, float threshold) const
     {
-        float d = (point - entry.point) * ((normal + entry.normal) / 2);
+        float d = (point - entryPoint) * ((normal + entryNormal) / 2);
         return (d >= -0.01 && weight > 1 / threshold);
     }
 
-    bool IrradianceCached::Cache::visitOctreeNode(OctreeNode *node, const Math::Point &origin, float size, const Math::Point &point, const std::function<bool(const Entry &)> &callback) const
+    template<typename Callback> bool IrradianceCached::Cache::visitOctreeNode(OctreeNode *node, const Math::Point &origin, float size, const Math::Point &point, Callback &callback) const
     {
         if (!node) {
             return true;
@@ -182,7 +275,7 @@ namespace Render::Cpu::Impl::Lighter {
 
             getChildNode(origin, size, i, childOrigin, childSize);
 
-            float distance2 = distance2ToNode(point, i, childOrigin, childSize);
+            float distance2 = distance2ToNode(point, childOrigin, childSize);
             if (distance2 < childSize * childSize) {
                 if (!visitOctreeNode(node->children[i].get(), childOrigin, childSize, point, callback)) {
                     return false;
@@ -193,6 +286,41 @@ namespace Render::Cpu::Impl::Lighter {
         return true;
     }
 
+    template<typename Callback> void IrradianceCached::Cache::visitFlatNodes(const Math::Point &point, Callback &callback) const
+    {
+        if (mFlatNodes.empty()) {
+            return;
+        }
+
+        unsigned int localStack[kFlatStackSize];
+        std::vector<unsigned int> heapStack;
+        unsigned int *stack = localStack;
+        if (mFlatStackSize > kFlatStackSize) {
+            heapStack.resize(mFlatStackSize);
+            stack = heapStack.data();
+        }
+
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const FlatNode &node = mFlatNodes[stack[--stackSize]];
+
+            for (unsigned int i = node.firstEntry; i < node.firstEntry + node.numEntries; i++) {
+                if (!callback(i)) {
+                    return;
+                }
+            }
+
+            for (unsigned int i = node.firstChild; i < node.firstChild + node.numChildren; i++) {
+                const FlatNode &child = mFlatNodes[i];
+                if (distance2ToNode(point, child.origin, child.size) < child.size * child.size) {
+                    stack[stackSize++] = i;
+                }
+            }
+        }
+    }
+
     bool IrradianceCached::Cache::test(const Math::Point &point, const Math::Normal &normal) const
     {
         std::lock_guard<std::mutex> guard(mMutex);
@@ -203,15 +331,16 @@ namespace Render::Cpu::Impl::Lighter {
     {
         bool ret = false;
         auto callback = [&](const Entry &entry) {
-            float w = weight(entry, point, normal);
-            if (isEntryValid(entry, point, normal, w, mThreshold)) {
+            float w = weight(entry.point, entry.normal, lookupRadius(entry), point, normal);
+            if (isEntryValid(entry.point, entry.normal, point, normal, w, mThreshold)) {
                 ret = true;
                 return false;
             }
             return true;
         };
 
-        visitOctreeNode(mOctreeRoot.get(), mOctreeOrigin, mOctreeSize, point, std::ref(callback));
+        visitOctreeNode(mOctreeRoot.get(), mOctreeOrigin, mOctreeSize, point, callback);
+        Stats::count(ret ? Stats::Counter::IrradianceCacheHits : Stats::Counter::IrradianceCacheMisses);
 
         return ret;
     }
@@ -228,24 +357,27 @@ namespace Render::Cpu::Impl::Lighter {
         Math::Radiance irradiance;
         float threshold = mThreshold;
 
-        auto callback = [&] (const Entry &entry) {
-            float w = weight(entry, point, normal);
-            if (isEntryValid(entry, point, normal, w, threshold)) {
+        auto callback = [&] (unsigned int idx) {
+            const Math::Point &entryPoint = mFlatPoints[idx];
+            const Math::Normal &entryNormal = mFlatNormals[idx];
+            float w = weight(entryPoint, entryNormal, mFlatRadii[idx], point, normal);
+            if (isEntryValid(entryPoint, entryNormal, point, normal, w, threshold)) {
+                const EntryPayload &payload = mFlatPayloads[idx];
                 if (std::isinf(w)) {
-                    irradiance = entry.radiance;
+                    irradiance = payload.radiance;
                     totalWeight = 1;
                     return false;
                 }
-                Math::Vector cross = Math::Vector(normal % entry.normal);
-                Math::Vector dist = point - entry.point;
-                irradiance += (entry.radiance + entry.rotGrad * cross + entry.transGrad * dist) * w;
+                Math::Vector cross = Math::Vector(normal % entryNormal);
+                Math::Vector dist = point - entryPoint;
+                irradiance += (payload.radiance + payload.rotGrad * cross + payload.transGrad * dist) * w;
                 totalWeight += w;
             }
             return true;
         };
 
         for(int i=0; i<3; i++) {
-            visitOctreeNode(mOctreeRoot.get(), mOctreeOrigin, mOctreeSize, point, std::ref(callback));
+            visitFlatNodes(point, callback);
 
             if (totalWeight > 0) {
                 irradiance = irradiance / totalWeight;
@@ -263,7 +395,7 @@ namespace Render::Cpu::Impl::Lighter {
     {
         std::lock_guard<std::mutex> guard(mMutex);
 
-        float R = entry.radius * mThreshold;
+        float R = lookupRadius(entry) * mThreshold;
 
         if (!mOctreeRoot) {
             mOctreeRoot = std::make_unique<OctreeNode>();
@@ -316,12 +448,226 @@ namespace Render::Cpu::Impl::Lighter {
         mOctreeRoot.release();
     }
 
+    void IrradianceCached::Cache::freeze()
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+
+        mFlatNodes.clear();
+        mFlatPoints.clear();
+        mFlatNormals.clear();
+        mFlatRadii.clear();
+        mFlatPayloads.clear();
+        mFlatStackSize = 0;
+
+        if (!mOctreeRoot) {
+            return;
+        }
+
+        std::vector<const OctreeNode*> queue;
+        std::vector<unsigned int> depths;
+        queue.push_back(mOctreeRoot.get());
+        depths.push_back(0);
+        mFlatNodes.push_back(FlatNode{mOctreeOrigin, mOctreeSize, 0, 0, 0, 0});
+
+        for (unsigned int i = 0; i < queue.size(); i++) {
+            const OctreeNode *node = queue[i];
+            Math::Point origin = mFlatNodes[i].origin;
+            float size = mFlatNodes[i].size;
+
+            mFlatNodes[i].firstEntry = static_cast<unsigned int>(mFlatPoints.size());
+            mFlatNodes[i].numEntries = static_cast<unsigned int>(node->entries.size());
+            for (const Entry &entry : node->entries) {
+                mFlatPoints.push_back(entry.point);
+                mFlatNormals.push_back(entry.normal);
+                float minR = minRadius(entry.point);
+                RadianceGradient transGrad = entry.transGrad;
+                if (entry.radius < minR) {
+                    transGrad = transGrad * entry.radius / minR;
+                }
+
+                mFlatRadii.push_back(lookupRadius(entry));
+                mFlatPayloads.push_back(EntryPayload{entry.radiance, entry.rotGrad, transGrad});
+            }
+
+            unsigned int firstChild = static_cast<unsigned int>(mFlatNodes.size());
+            for (int j = 0; j < 8; j++) {
+                if (node->children[j]) {
+                    Math::Point childOrigin;
+                    float childSize;
+                    getChildNode(origin, size, j, childOrigin, childSize);
+
+                    queue.push_back(node->children[j].get());
+                    depths.push_back(depths[i] + 1);
+                    mFlatNodes.push_back(FlatNode{childOrigin, childSize, 0, 0, 0, 0});
+                }
+            }
+            mFlatNodes[i].firstChild = firstChild;
+            mFlatNodes[i].numChildren = static_cast<unsigned int>(mFlatNodes.size()) - firstChild;
+        }
+
+        // Depth-first traversal leaves at most 7 pending siblings per level on the stack
+        mFlatStackSize = 7 * depths.back() + 1;
+    }
+
+    void IrradianceCached::Cache::collectEntries(const OctreeNode *node, std::vector<Entry> &entries) const
+    {
+        if (!node) {
+            return;
+        }
+
+        entries.insert(entries.end(), node->entries.begin(), node->entries.end());
+        for (int i = 0; i < 8; i++) {
+            collectEntries(node->children[i].get(), entries);
+        }
+    }
+
+    static const char kCacheMagic[8] = { 'R', 'T', 'I', 'R', 'R', 'C', 'H', '\0' };
+    static const uint32_t kCacheVersion = 2;
+
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t entrySize;
+        uint64_t key;
+        uint64_t count;
+    };
+
+    bool IrradianceCached::Cache::load(const std::string &filename, uint64_t key, std::string &error)
+    {
+        std::ifstream file(filename.c_str(), std::ios_base::binary);
+        if (!file.good()) {
+            return true;
+        }
+
+        file.seekg(0, std::ios_base::end);
+        uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0);
+
+        CacheHeader header;
+        if (fileSize < sizeof(header) || !file.read((char*)&header, sizeof(header))
+            || std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0) {
+            error = "Ignoring irradiance cache " + filename + ": not an irradiance cache file";
+            return false;
+        }
+
+        if (header.version != kCacheVersion || header.entrySize != sizeof(Entry)) {
+            error = "Ignoring irradiance cache " + filename + ": written by a different version";
+            return false;
+        }
+
+        if (header.key != key) {
+            error = "Ignoring irradiance cache " + filename + ": written for a different scene or settings";
+            return false;
+        }
+
+        if (header.count != (fileSize - sizeof(header)) / sizeof(Entry) || (fileSize - sizeof(header)) % sizeof(Entry) != 0) {
+            error = "Ignoring irradiance cache " + filename + ": file is truncated";
+            return false;
+        }
+
+        std::vector<Entry> entries;
+        entries.resize(static_cast<size_t>(header.count));
+        if (header.count > 0) {
+            file.read((char*)&entries[0], entries.size() * sizeof(Entry));
+        }
+
+        if (!file.good()) {
+            error = "Ignoring irradiance cache " + filename + ": read failed";
+            return false;
+        }
+
+        for (const Entry &entry : entries) {
+            add(entry);
+        }
+
+        return true;
+    }
+
+    void IrradianceCached::Cache::save(const std::string &filename, uint64_t key) const
+    {
+        std::vector<Entry> entries;
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            collectEntries(mOctreeRoot.get(), entries);
+        }
+
+        std::ofstream file(filename.c_str(), std::ios_base::binary);
+
+        CacheHeader header;
+        std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+        header.version = kCacheVersion;
+        header.entrySize = sizeof(Entry);
+        header.key = key;
+        header.count = entries.size();
+        file.write((const char*)&header, sizeof(header));
+        if (!entries.empty()) {
+            file.write((const char*)&entries[0], entries.size() * sizeof(Entry));
+        }
+    }
+
+    static uint64_t cacheKey(const Object::Scene &scene, const IrradianceCached::Settings &settings)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto addBytes = [&](const void *data, size_t size) {
+            const unsigned char *bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+
+        uint64_t counts[] = { scene.primitives().size(), scene.lights().size(), scene.areaLights().size(), settings.indirectSamples };
+        addBytes(counts, sizeof(counts));
+        addBytes(&settings.cacheThreshold, sizeof(settings.cacheThreshold));
+
+        for (const Object::Primitive &light : scene.areaLights()) {
+            Math::Radiance radiance = light.surface().radiance();
+            float values[] = { radiance.red(), radiance.green(), radiance.blue() };
+            addBytes(values, sizeof(values));
+        }
+
+        for (const Object::Light &light : scene.lights()) {
+            const Object::Impl::Light::Point *pointLight = dynamic_cast<const Object::Impl::Light::Point*>(&light);
+            if (pointLight) {
+                PointLightProxy proxy;
+                std::memset(&proxy, 0, sizeof(proxy));
+                pointLight->writeProxy(proxy);
+                addBytes(&proxy, sizeof(proxy));
+            }
+        }
+
+        for (const Object::Light &light : scene.skyLights()) {
+            Math::Vector directions[] = { Math::Vector(1, 0, 0), Math::Vector(-1, 0, 0), Math::Vector(0, 1, 0), Math::Vector(0, -1, 0), Math::Vector(0, 0, 1), Math::Vector(0, 0, -1) };
+            for (const Math::Vector &direction : directions) {
+                Math::Radiance radiance = light.radiance(direction);
+                float values[] = { radiance.red(), radiance.green(), radiance.blue() };
+                addBytes(values, sizeof(values));
+            }
+        }
+
+        for (const Object::BoundingVolumeHierarchy::Node &node : scene.boundingVolumeHierarchy().nodes()) {
+            addBytes(&node.volume, sizeof(node.volume));
+            addBytes(&node.index, sizeof(node.index));
+        }
+
+        return hash;
+    }
+
     IrradianceCached::IrradianceCached(const Settings &settings)
         : mSettings(settings)
     {
         mDirectLighter = std::make_unique<Impl::Lighter::Direct>();
         mUniPathLighter = std::make_unique<Impl::Lighter::UniPath>();
         mCache = std::make_unique<Cache>(settings.cacheThreshold);
+        mCacheKey = 0;
+    }
+
+    IrradianceCached::~IrradianceCached()
+    {
+    }
+
+    std::vector<std::string> IrradianceCached::warnings() const
+    {
+        return mWarnings;
     }
 
     Math::Radiance IrradianceCached::light(const Object::Intersection &isect, Math::Sampler &sampler) const
@@ -347,19 +693,50 @@ namespace Render::Cpu::Impl::Lighter {
 
     std::vector<std::unique_ptr<Render::Cpu::Executor::Job>> IrradianceCached::createPrerenderJobs(const Object::Scene &scene, Render::Framebuffer &framebuffer)
     {
-        std::unique_ptr<Executor::Job> job = std::make_unique<Render::Cpu::RasterJob>(
-            framebuffer.width(),
-            framebuffer.height(),
-            1,
-            [&]() { return std::make_unique<ThreadLocal>(); },
-            [&](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
-                {
-                    prerenderPixel(x, y, framebuffer, scene, static_cast<ThreadLocal&>(threadLocalBase).sampler);
-                }
-        );
-
         std::vector<std::unique_ptr<Render::Cpu::Executor::Job>> jobs;
-        jobs.push_back(std::move(job));
+
+        mCache->setView(scene.camera(), framebuffer.width());
+        if (!mSettings.cacheFile.empty()) {
+            mCacheKey = cacheKey(scene, mSettings);
+            std::string error;
+            if (!mCache->load(mSettings.cacheFile, mCacheKey, error)) {
+                mWarnings.push_back(error);
+            }
+        }
+
+        for (int stride = kCoarsestStride; stride >= 1; stride /= 2) {
+            Render::Cpu::RasterJob::DoneFunc doneFunc;
+            if (stride == 1) {
+                doneFunc = [&]()
+                    {
+                        mCache->freeze();
+                        if (!mSettings.cacheFile.empty()) {
+                            mCache->save(mSettings.cacheFile, mCacheKey);
+                        }
+                    };
+            }
+
+            std::unique_ptr<Executor::Job> job = std::make_unique<Render::Cpu::RasterJob>(
+                (framebuffer.width() + stride - 1) / stride,
+                (framebuffer.height() + stride - 1) / stride,
+                1,
+                [&]() { return std::make_unique<ThreadLocal>(); },
+                [&, stride](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
+                    {
+                        x *= stride;
+                        y *= stride;
+                        if (stride < kCoarsestStride && x % (stride * 2) == 0 && y % (stride * 2) == 0) {
+                            return;
+                        }
+
+                        Stats::ScopedTimer timer(Stats::Timer::Prerender);
+                        prerenderPixel(x, y, framebuffer, scene, static_cast<ThreadLocal&>(threadLocalBase).sampler);
+                    },
+                std::move(doneFunc)
+            );
+            jobs.push_back(std::move(job));
+        }
+
         return jobs;
     }
 
@@ -380,61 +757,52 @@ namespace Render::Cpu::Impl::Lighter {
             if (!mCache->test(pnt, nrmFacing)) {
                 Math::OrthonormalBasis basis(nrmFacing);
 
-                float mean = 0;
-                int den = 0;
-                Math::Radiance rad;
-                const unsigned int M = static_cast<unsigned int>(std::sqrt(mSettings.indirectSamples));
-                const unsigned int N = static_cast<unsigned int>(mSettings.indirectSamples / M);
+                struct GatherResult {
+                    float invDistance = 0;
+                    int hits = 0;
+                    unsigned int count = 0;
+                    Math::Radiance rad;
+                    RadianceGradient transGrad;
+                    RadianceGradient rotGrad;
+                };
+
                 std::vector<Math::Radiance> samples;
                 std::vector<float> sampleDistances;
-                samples.resize(M * N);
-                sampleDistances.resize(M * N);
-                for (unsigned int k = 0; k < N; k++) {
-                    for (unsigned int j = 0; j < M; j++) {
-                        sampler.startSample();
-
-                        float phi = 2 * M_PI * (k + sampler.getValue()) / N;
-                        float theta = std::asin(std::sqrt((j + sampler.getValue()) / M));
-                        Math::Vector dirIn = basis.localToWorld(Math::Vector::fromPolar(phi, theta, 1));
-
-                        Math::Point pntOffset = pnt + Math::Vector(nrmFacing) * 0.01f;
-                        Math::Ray ray(pntOffset, dirIn);
-                        Math::Beam beam(ray, Math::Bivector(), Math::Bivector());
-                        Object::Intersection isect2 = scene.intersect(beam, FLT_MAX, true);
-
-                        if (isect2.valid()) {
-                            mean += 1 / isect2.distance();
-                            den++;
-                            Math::Radiance rad2 = mUniPathLighter->light(isect2, sampler);
-                            rad2 = rad2 - isect2.primitive().surface().radiance();
-
-                            samples[k * M + j] = rad2;
-                            sampleDistances[k * M + j] = isect2.distance();
-
-                            rad += rad2 * (float)M_PI / (float)(M * N);
-                        }
-                        else {
-                            sampleDistances[k * M + j] = static_cast<float>(FLT_MAX);
-                        }
-                    }
-                }
+                auto gather = [&](unsigned int sampleCount, GatherResult &result) {
+                    unsigned int M = static_cast<unsigned int>(std::sqrt(sampleCount));
+                    unsigned int N = static_cast<unsigned int>(sampleCount / M);
+                    samples.assign(M * N, Math::Radiance());
+                    sampleDistances.assign(M * N, 0.0f);
+                    for (unsigned int k = 0; k < N; k++) {
+                        for (unsigned int j = 0; j < M; j++) {
+                            sampler.startSample();
 
-                if (mean > 0) {
-                    mean = den / mean;
+                            float phi = 2 * M_PI * (k + sampler.getValue()) / N;
+                            float theta = std::asin(std::sqrt((j + sampler.getValue()) / M));
+                            Math::Vector dirIn = basis.localToWorld(Math::Vector::fromPolar(phi, theta, 1));
 
-                    Cache::Entry newEntry;
-                    newEntry.point = pnt;
-                    newEntry.normal = nrmFacing;
-                    newEntry.radiance = rad;
+                            Math::Point pntOffset = pnt + Math::Vector(nrmFacing) * 0.01f;
+                            Math::Ray ray(pntOffset, dirIn);
+                            Math::Beam beam(ray, Math::Bivector(), Math::Bivector());
+                            Object::Intersection isect2 = scene.intersect(beam, FLT_MAX, true);
 
-                    float radius = mean;
-                    float projectedPixelSize = scene.camera().projectSize(2.0f / framebuffer.width(), isect.distance());
-                    float minRadius = 3 * projectedPixelSize / mCache->threshold();
-                    float maxRadius = 20 * minRadius;
-                    newEntry.radius = std::min(std::max(radius, minRadius), maxRadius);
+                            if (isect2.valid()) {
+                                result.invDistance += 1 / isect2.distance();
+                                result.hits++;
+                                Math::Radiance rad2 = mUniPathLighter->light(isect2, sampler);
+                                rad2 = rad2 - isect2.primitive().surface().radiance();
+
+                                samples[k * M + j] = rad2;
+                                sampleDistances[k * M + j] = isect2.distance();
+
+                                result.rad += rad2 * (float)M_PI / (float)(M * N);
+                            }
+                            else {
+                                sampleDistances[k * M + j] = static_cast<float>(FLT_MAX);
+                            }
+                        }
+                    }
 
-                    RadianceGradient transGrad;
-                    RadianceGradient rotGrad;
                     for (unsigned int k = 0; k < N; k++) {
                         unsigned int k1 = (k > 0) ? (k - 1) : N - 1;
                         float phi = 2 * M_PI * k / N;
@@ -449,22 +817,55 @@ namespace Render::Cpu::Impl::Lighter {
                                 unsigned int j1 = j - 1;
 
                                 Math::Vector c = u * std::sin(thetaMinus) * std::cos(thetaMinus) * std::cos(thetaMinus) * 2 * (float)M_PI / (N * std::min(sampleDistances[k * M + j], sampleDistances[k * M + j1]));
-                                transGrad += RadianceGradient(samples[k * M + j] - samples[k * M + j1], c);
+                                result.transGrad += RadianceGradient(samples[k * M + j] - samples[k * M + j1], c);
                             }
 
                             Math::Vector c = v * (std::sin(thetaPlus) - std::sin(thetaMinus)) / std::min(sampleDistances[k * M + j], sampleDistances[k1 * M + j]);
-                            transGrad += RadianceGradient(samples[k * M + j] - samples[k1 * M + j], c);
+                            result.transGrad += RadianceGradient(samples[k * M + j] - samples[k1 * M + j], c);
 
-                            rotGrad += RadianceGradient(samples[k * M + j], v) * std::tan(thetaMinus) * (float)M_PI / (float)(M * N);
+                            result.rotGrad += RadianceGradient(samples[k * M + j], v) * std::tan(thetaMinus) * (float)M_PI / (float)(M * N);
                         }
                     }
 
-                    if (radius < minRadius) {
-                        transGrad = transGrad * radius / minRadius;
+                    result.count = M * N;
+                };
+
+                unsigned int pilotSamples = std::min(mSettings.indirectSamples, std::max(mSettings.indirectSamples / 4, kMinPilotSamples));
+                GatherResult gathered;
+                gather(pilotSamples, gathered);
+                if (pilotSamples < mSettings.indirectSamples && relativeError(samples) > kMaxRelativeError) {
+                    // Top up the pilot with the remaining samples and weight each estimate by its sample count
+                    GatherResult remaining;
+                    gather(mSettings.indirectSamples - pilotSamples, remaining);
+
+                    float total = static_cast<float>(gathered.count + remaining.count);
+                    float pilotWeight = gathered.count / total;
+                    float remainingWeight = remaining.count / total;
+                    gathered.invDistance += remaining.invDistance;
+                    gathered.hits += remaining.hits;
+                    gathered.rad = gathered.rad * pilotWeight + remaining.rad * remainingWeight;
+                    gathered.transGrad = gathered.transGrad * pilotWeight + remaining.transGrad * remainingWeight;
+                    gathered.rotGrad = gathered.rotGrad * pilotWeight + remaining.rotGrad * remainingWeight;
+                    gathered.count += remaining.count;
+                }
+
+                if (gathered.invDistance > 0) {
+                    float mean = gathered.hits / gathered.invDistance;
+
+                    Cache::Entry newEntry;
+                    newEntry.point = pnt;
+                    newEntry.normal = nrmFacing;
+                    newEntry.radiance = gathered.rad;
+
+                    float radius = mean;
+                    float gradientMagnitude = gathered.transGrad.magnitude();
+                    if (gradientMagnitude > 0) {
+                        radius = std::min(radius, gathered.rad.magnitude() / gradientMagnitude);
                     }
 
-                    newEntry.transGrad = transGrad;
-                    newEntry.rotGrad = rotGrad;
+                    newEntry.radius = radius;
+                    newEntry.transGrad = gathered.transGrad;
+                    newEntry.rotGrad = gathered.rotGrad;
 
                     mCache->add(newEntry);
                     pixelColor = Math::Color(1, 1, 1);
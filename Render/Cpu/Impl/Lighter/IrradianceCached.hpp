@@ -6,7 +6,10 @@
 #include "Render/Cpu/Impl/Lighter/Direct.hpp"
 #include "Render/Cpu/Impl/Lighter/UniPath.hpp"
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace Render::Cpu::Impl::Lighter {
     class IrradianceCached : public Render::Cpu::Lighter
@@ -15,13 +18,16 @@ namespace Render::Cpu::Impl::Lighter {
         struct Settings {
             unsigned int indirectSamples;
             float cacheThreshold;
+            std::string cacheFile;
         };
 
         IrradianceCached(const Settings &settings);
+        ~IrradianceCached();
 
         Math::Radiance light(const Object::Intersection &isect, Math::Sampler &sampler) const override;
 
         std::vector<std::unique_ptr<Render::Cpu::Executor::Job>> createPrerenderJobs(const Object::Scene &scene, Render::Framebuffer &framebuffer) override;
+        std::vector<std::string> warnings() const override;
 
     private:
         void prerenderPixel(unsigned int x, unsigned int y, Render::Framebuffer &framebuffer, const Object::Scene &scene, Math::Sampler &sampler);
@@ -32,6 +38,8 @@ namespace Render::Cpu::Impl::Lighter {
         std::unique_ptr<Impl::Lighter::Direct> mDirectLighter;
         std::unique_ptr<Cache> mCache;
         Settings mSettings;
+        uint64_t mCacheKey;
+        std::vector<std::string> mWarnings;
     };
 }
 
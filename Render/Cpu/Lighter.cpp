@@ -13,4 +13,9 @@ namespace Render::Cpu {
     {
         return std::vector<std::unique_ptr<Render::Cpu::Executor::Job>>();
     }
+
+    std::vector<std::string> Lighter::warnings() const
+    {
+        return std::vector<std::string>();
+    }
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 
 #include <vector>
 #include <memory>
+#include <string>
 
 namespace Render::Cpu {
     class Lighter {
@@ -21,6 +22,7 @@ namespace Render::Cpu {
 
         virtual Math::Radiance light(const Object::Intersection &isect, Math::Sampler &sampler) const = 0;
         virtual std::vector<std::unique_ptr<Render::Cpu::Executor::Job>> createPrerenderJobs(const Object::Scene &scene, Render::Framebuffer &framebuffer);
+        virtual std::vector<std::string> warnings() const;
     };
 }
 
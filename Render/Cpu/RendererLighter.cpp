@@ -3,7 +3,12 @@
 
 #include "Math/Impl/Sampler/Halton.hpp"
 
+#include "Stats.hpp"
+
+#include <algorithm>
 #include <atomic>
+#include <climits>
+#include <cmath>
 #include <mutex>
 
 namespace Render::Cpu {
@@ -12,12 +17,17 @@ namespace Render::Cpu {
 
         ThreadLocal(int width, int height) : sampler(width, height) {}
     };
+
+    static const unsigned int kMinAdaptiveSamples = 4;
+    static const unsigned int kMaxAdaptiveSampleFactor = 8;
         
     RendererLighter::RendererLighter(const Object::Scene &scene, const Settings &settings, std::unique_ptr<Render::Cpu::Lighter> lighter)
     : mScene(scene)
     , mSettings(settings)
     , mLighter(std::move(lighter))
-    , mTotalRadiance(settings.width, settings.height)
+    , mMeanRadiance(settings.width, settings.height)
+    , mPixelStats(settings.width, settings.height)
+    , mDisplayRadiance(settings.width, settings.height)
     {
         mRenderFramebuffer = std::make_unique<Render::Framebuffer>(settings.width, settings.height);
 
@@ -28,18 +38,39 @@ namespace Render::Cpu {
             }
         }
 
-        std::unique_ptr<Executor::Job> job = 
-            std::make_unique<RasterJob>(
-                settings.width,
-                settings.height,
-                settings.samples,
-                [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height()); },
-                [&](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
-                    {
-                        renderPixel(x, y, sample, static_cast<ThreadLocal&>(threadLocalBase).sampler);
-                    }
-            );
-        mJobs.push_back(std::move(job));
+        bool unlimitedSamples = (settings.timeBudget > 0 && settings.samples == 0);
+        mUniformSamples = unlimitedSamples ? UINT_MAX : settings.samples;
+        mSamplesRemaining = 0;
+        mPassSamples = 0;
+        if(mLighter && mSettings.adaptiveThreshold > 0) {
+            if(unlimitedSamples) {
+                mUniformSamples = kMinAdaptiveSamples;
+                mSamplesRemaining = UINT64_MAX;
+            } else {
+                mUniformSamples = std::min(settings.samples, std::max(settings.samples / 4, kMinAdaptiveSamples));
+                mSamplesRemaining = uint64_t(settings.width) * settings.height * (settings.samples - mUniformSamples);
+            }
+            mPassSamples = mUniformSamples;
+        }
+
+        mNextSample = 1;
+        mDisplayValid = false;
+        mJobs.push_back(createSampleJob(0));
+    }
+
+    std::unique_ptr<Executor::Job> RendererLighter::createSampleJob(unsigned int sample)
+    {
+        return std::make_unique<RasterJob>(
+            mSettings.width,
+            mSettings.height,
+            1,
+            [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height()); },
+            [&, sample](int x, int y, int, Executor::Job::ThreadLocal &threadLocalBase)
+                {
+                    Stats::ScopedTimer timer(Stats::Timer::Sample);
+                    renderPixel(x, y, sample, static_cast<ThreadLocal&>(threadLocalBase).sampler);
+                }
+        );
     }
 
     void RendererLighter::start(Listener *listener)
@@ -48,6 +79,7 @@ namespace Render::Cpu {
         mStartTime = std::chrono::steady_clock::now();
 
         mCurrentJob = 0;
+        Stats::reset();
         mExecutor.runJob(std::move(mJobs[mCurrentJob]), [&]() { jobDone(); });
     }
 
@@ -66,21 +98,181 @@ namespace Render::Cpu {
         return *mRenderFramebuffer;
     }
 
+    void RendererLighter::updateFramebuffer()
+    {
+        if(!mLighter) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        if(!mDisplayValid) {
+            return;
+        }
+
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                mRenderFramebuffer->setPixel(x, y, Framebuffer::toneMap(mDisplayRadiance.get(x, y)));
+            }
+        }
+    }
+
+    Math::Radiance RendererLighter::radiance(unsigned int x, unsigned int y)
+    {
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        return mDisplayRadiance.get(x, y);
+    }
+
+    std::vector<std::string> RendererLighter::warnings()
+    {
+        return mLighter ? mLighter->warnings() : std::vector<std::string>();
+    }
+
+    void RendererLighter::snapshotRadiance()
+    {
+        // Called between jobs, while no worker is writing the per-pixel accumulators
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                mDisplayRadiance.set(x, y, mMeanRadiance.get(x, y));
+            }
+        }
+        mDisplayValid = true;
+    }
+
     void RendererLighter::jobDone()
     {
         mCurrentJob++;
+        if(mCurrentJob >= mJobs.size()) {
+            snapshotRadiance();
+        }
+
         if(mCurrentJob < mJobs.size()) {
             mExecutor.runJob(std::move(mJobs[mCurrentJob]), [&]() { jobDone(); });
-        } else {
+        } else if(!startNextPass()) {
             auto endTime = std::chrono::steady_clock::now();
             std::chrono::duration<double> duration = endTime - mStartTime;
-            mListener->onRendererDone(duration.count());
+
+            float samplesPerPixel = static_cast<float>(mNextSample);
+            if(mLighter) {
+                uint64_t totalSamples = 0;
+                for(unsigned int y = 0; y < mSettings.height; y++) {
+                    for(unsigned int x = 0; x < mSettings.width; x++) {
+                        totalSamples += mPixelStats.get(x, y).samples;
+                    }
+                }
+                samplesPerPixel = static_cast<float>(totalSamples) / (mSettings.width * mSettings.height);
+            }
+
+            mListener->onRendererDone(duration.count(), samplesPerPixel);
+        }
+    }
+
+    bool RendererLighter::startNextPass()
+    {
+        if(mSettings.timeBudget > 0) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - mStartTime;
+            if(elapsed.count() >= mSettings.timeBudget) {
+                return false;
+            }
+        }
+
+        if(mNextSample < mUniformSamples) {
+            mExecutor.runJob(createSampleJob(mNextSample), [&]() { jobDone(); });
+            mNextSample++;
+            return true;
+        }
+
+        if(mLighter && mSettings.adaptiveThreshold > 0) {
+            return startAdaptivePass();
+        }
+
+        return false;
+    }
+
+    float RendererLighter::pixelError(const PixelStats &stats) const
+    {
+        if(stats.samples < 2) {
+            return FLT_MAX;
+        }
+
+        float standardError = std::sqrt(stats.m2 / ((stats.samples - 1) * stats.samples));
+        return standardError / ((stats.mean + 1) * (stats.mean + 1));
+    }
+
+    bool RendererLighter::startAdaptivePass()
+    {
+        if(mSamplesRemaining == 0) {
+            return false;
+        }
+
+        unsigned int maxSamples = (mSettings.samples > 0) ? mSettings.samples * kMaxAdaptiveSampleFactor : UINT_MAX;
+        std::vector<std::pair<float, unsigned int>> candidates;
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                const PixelStats &stats = mPixelStats.get(x, y);
+                float error = pixelError(stats);
+                if(stats.samples < maxSamples && error > mSettings.adaptiveThreshold) {
+                    candidates.push_back(std::make_pair(error, y * mSettings.width + x));
+                }
+            }
         }
+
+        if(candidates.empty()) {
+            return false;
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        if(candidates.size() > mSamplesRemaining) {
+            candidates.resize(static_cast<size_t>(mSamplesRemaining));
+        }
+
+        mActivePixels.clear();
+        for(const auto &candidate : candidates) {
+            mActivePixels.push_back(candidate.second);
+        }
+
+        uint64_t passSamples = std::max(uint64_t(1), std::min(uint64_t(mPassSamples), mSamplesRemaining / mActivePixels.size()));
+        mSamplesRemaining -= passSamples * mActivePixels.size();
+
+        // Lay the active pixels out in rows of the frame width, so the job is split like a uniform pass
+        unsigned int numActive = static_cast<unsigned int>(mActivePixels.size());
+        unsigned int jobWidth = std::min(numActive, mSettings.width);
+        unsigned int jobHeight = (numActive + jobWidth - 1) / jobWidth;
+
+        std::unique_ptr<Executor::Job> job = 
+            std::make_unique<RasterJob>(
+                static_cast<int>(jobWidth),
+                static_cast<int>(jobHeight),
+                1,
+                [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height()); },
+                [&, passSamples, maxSamples, jobWidth, numActive](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
+                    {
+                        unsigned int index = y * jobWidth + x;
+                        if(index >= numActive) {
+                            return;
+                        }
+
+                        Stats::ScopedTimer timer(Stats::Timer::Sample);
+                        int pixelX = mActivePixels[index] % mSettings.width;
+                        int pixelY = mActivePixels[index] / mSettings.width;
+                        for(unsigned int i = 0; i < passSamples; i++) {
+                            unsigned int pixelSample = mPixelStats.get(pixelX, pixelY).samples;
+                            if(pixelSample >= maxSamples) {
+                                break;
+                            }
+                            renderPixel(pixelX, pixelY, pixelSample, static_cast<ThreadLocal&>(threadLocalBase).sampler);
+                        }
+                    }
+            );
+        mExecutor.runJob(std::move(job), [&]() { jobDone(); });
+
+        return true;
     }
 
     void RendererLighter::renderPixel(int x, int y, int sample, Math::Sampler &sampler)
     {
         Math::Bivector dv;
+        Stats::count(Stats::Counter::PrimaryRays);
         sampler.startSample(x, y, sample);
         Math::Point2D imagePoint = Math::Point2D((float)x, (float)y) + sampler.getValue2D();
         Math::Point2D aperturePoint = sampler.getValue2D();
@@ -98,14 +290,21 @@ namespace Render::Cpu {
                 }
             }
     
-            Math::Radiance radTotal = mTotalRadiance.get(x, y) + rad;
-            mTotalRadiance.set(x, y, radTotal);
-            Math::Color color = Framebuffer::toneMap(radTotal / static_cast<float>(sample + 1));
-            mRenderFramebuffer->setPixel(x, y, color);
+            PixelStats &stats = mPixelStats.at(x, y);
+            float value = rad.magnitude();
+            float delta = value - stats.mean;
+            stats.samples++;
+            stats.mean += delta / stats.samples;
+            stats.m2 += delta * (value - stats.mean);
+
+            Math::Radiance radMean = mMeanRadiance.get(x, y);
+            radMean += (rad - radMean) / static_cast<float>(stats.samples);
+            mMeanRadiance.set(x, y, radMean);
         } else {
             if(isect.valid()) {
                 Math::Color color = isect.albedo();
                 mRenderFramebuffer->setPixel(x, y, color);
+                mMeanRadiance.set(x, y, Math::Radiance(color.red(), color.green(), color.blue()));
             }
         }
     }
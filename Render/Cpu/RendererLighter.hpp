@@ -13,6 +13,9 @@
 
 #include <memory>
 #include <chrono>
+#include <vector>
+#include <cstdint>
+#include <mutex>
 
 namespace Render::Cpu {
     class RendererLighter : public Render::Renderer {
@@ -22,6 +25,8 @@ namespace Render::Cpu {
             unsigned int width;
             unsigned int height;
             unsigned int samples;
+            float adaptiveThreshold;
+            float timeBudget;
         };
         RendererLighter(const Object::Scene &scene, const Settings &settings, std::unique_ptr<Render::Cpu::Lighter> lighter);
 
@@ -30,9 +35,24 @@ namespace Render::Cpu {
         bool running() override;
 
         Render::Framebuffer &renderFramebuffer() override;
+        void updateFramebuffer() override;
+        Math::Radiance radiance(unsigned int x, unsigned int y) override;
+        std::vector<std::string> warnings() override;
 
     private:
+        struct PixelStats
+        {
+            unsigned int samples;
+            float mean;
+            float m2;
+        };
+
         void jobDone();
+        void snapshotRadiance();
+        std::unique_ptr<Executor::Job> createSampleJob(unsigned int sample);
+        bool startNextPass();
+        bool startAdaptivePass();
+        float pixelError(const PixelStats &stats) const;
         void renderPixel(int x, int y, int sample, Math::Sampler &sampler);
 
         Executor mExecutor;
@@ -47,7 +67,16 @@ namespace Render::Cpu {
 
         std::unique_ptr<Render::Cpu::Lighter> mLighter;
 
-        Render::Raster<Math::Radiance> mTotalRadiance;
+        Render::Raster<Math::Radiance> mMeanRadiance;
+        Render::Raster<PixelStats> mPixelStats;
+        Render::Raster<Math::Radiance, Render::HalfRadianceStorage> mDisplayRadiance;
+        bool mDisplayValid;
+        std::mutex mDisplayMutex;
+        std::vector<unsigned int> mActivePixels;
+        unsigned int mPassSamples;
+        unsigned int mUniformSamples;
+        unsigned int mNextSample;
+        uint64_t mSamplesRemaining;
     };
 }
 #endif
\ No newline at end of file
@@ -1,21 +1,103 @@
+#define _USE_MATH_DEFINES
 #include "Render/Cpu/RendererReSTIR.hpp"
 #include "Render/Cpu/RasterJob.hpp"
 
+#include "Stats.hpp"
+
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <mutex>
 
 namespace Render::Cpu {
+    static const uint32_t kInvalidPrimitive = UINT32_MAX;
+    static const float kNeighbourNormalThreshold = 0.9f;
+    static const float kNeighbourDistanceThreshold = 0.1f;
+    static const unsigned int kNumNeighbourOffsets = 256;
+
+    static uint32_t encodeOctahedral(const Math::Vector &vector)
+    {
+        float l1 = std::abs(vector.x()) + std::abs(vector.y()) + std::abs(vector.z());
+        float u = vector.x() / l1;
+        float v = vector.y() / l1;
+        if(vector.z() < 0) {
+            float uFolded = (1 - std::abs(v)) * (u >= 0 ? 1.0f : -1.0f);
+            float vFolded = (1 - std::abs(u)) * (v >= 0 ? 1.0f : -1.0f);
+            u = uFolded;
+            v = vFolded;
+        }
+
+        uint32_t uBits = static_cast<uint32_t>(std::round((std::clamp(u, -1.0f, 1.0f) * 0.5f + 0.5f) * 65535.0f));
+        uint32_t vBits = static_cast<uint32_t>(std::round((std::clamp(v, -1.0f, 1.0f) * 0.5f + 0.5f) * 65535.0f));
+        return (uBits << 16) | vBits;
+    }
+
+    static Math::Vector decodeOctahedral(uint32_t bits)
+    {
+        float u = (bits >> 16) / 65535.0f * 2.0f - 1.0f;
+        float v = (bits & 0xffff) / 65535.0f * 2.0f - 1.0f;
+        float z = 1 - std::abs(u) - std::abs(v);
+        if(z < 0) {
+            float uUnfolded = (1 - std::abs(v)) * (u >= 0 ? 1.0f : -1.0f);
+            float vUnfolded = (1 - std::abs(u)) * (v >= 0 ? 1.0f : -1.0f);
+            u = uUnfolded;
+            v = vUnfolded;
+        }
+
+        return Math::Vector(u, v, z).normalize();
+    }
+
+    static Math::Vector decodeFacingNormal(uint32_t normalBits, uint32_t directionBits)
+    {
+        Math::Vector normal = decodeOctahedral(normalBits);
+        return (normal * decodeOctahedral(directionBits) > 0) ? normal : -normal;
+    }
+
+    static uint32_t packColor(const Math::Color &color)
+    {
+        uint32_t red = static_cast<uint32_t>(std::round(std::clamp(color.red(), 0.0f, 1.0f) * 255.0f));
+        uint32_t green = static_cast<uint32_t>(std::round(std::clamp(color.green(), 0.0f, 1.0f) * 255.0f));
+        uint32_t blue = static_cast<uint32_t>(std::round(std::clamp(color.blue(), 0.0f, 1.0f) * 255.0f));
+        return (red << 16) | (green << 8) | blue;
+    }
+
+    static Math::Color unpackColor(uint32_t bits)
+    {
+        return Math::Color(((bits >> 16) & 0xff) / 255.0f, ((bits >> 8) & 0xff) / 255.0f, (bits & 0xff) / 255.0f);
+    }
+
     RendererReSTIR::RendererReSTIR(const Object::Scene &scene, const Settings &settings)
     : mScene(scene)
     , mSettings(settings)
     , mDirectReservoirs(settings.width, settings.height)
     , mIndirectReservoirs(settings.width, settings.height)
+    , mSpatialDirectReservoirs(settings.width, settings.height)
     , mPrimaryHits(settings.width, settings.height)
     , mTotalRadiance(settings.width, settings.height)
+    , mDisplayRadiance(settings.width, settings.height)
     {
         mRenderFramebuffer = std::make_unique<Render::Framebuffer>(settings.width, settings.height);
+        mDisplayValid = false;
 
         mIndirectLighter = std::make_unique<Render::Cpu::Impl::Lighter::UniPath>();
+
+        for(uint32_t i = 0; i < scene.primitives().size(); i++) {
+            mPrimitiveIndices[scene.primitives()[i].get()] = i;
+        }
+
+        const float a1 = 0.7548776662f;
+        const float a2 = 0.5698402910f;
+        for(unsigned int i = 0; i < kNumNeighbourOffsets; i++) {
+            float u = std::fmod(0.5f + a1 * i, 1.0f);
+            float v = std::fmod(0.5f + a2 * i, 1.0f);
+            float r = std::sqrt(u) * mSettings.radius;
+            float phi = 2 * (float)M_PI * v;
+
+            NeighbourOffset offset;
+            offset.x = (int)std::round(r * std::cos(phi));
+            offset.y = (int)std::round(r * std::sin(phi));
+            mNeighbourOffsets.push_back(offset);
+        }
     }
 
     void RendererReSTIR::start(Listener *listener)
@@ -24,6 +106,11 @@ namespace Render::Cpu {
         mStartTime = std::chrono::steady_clock::now();
 
         mCurrentSample = 0;
+        {
+            std::lock_guard<std::mutex> lock(mDisplayMutex);
+            mDisplayValid = false;
+        }
+        Stats::reset();
         startInitialSampleJob();
     }
 
@@ -42,6 +129,38 @@ namespace Render::Cpu {
         return *mRenderFramebuffer;
     }
 
+    void RendererReSTIR::updateFramebuffer()
+    {
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        if(!mDisplayValid) {
+            return;
+        }
+
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                mRenderFramebuffer->setPixel(x, y, Framebuffer::toneMap(mDisplayRadiance.get(x, y)));
+            }
+        }
+    }
+
+    Math::Radiance RendererReSTIR::radiance(unsigned int x, unsigned int y)
+    {
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        return mDisplayRadiance.get(x, y);
+    }
+
+    void RendererReSTIR::snapshotRadiance()
+    {
+        // Called between passes, while no worker is writing mTotalRadiance
+        std::lock_guard<std::mutex> lock(mDisplayMutex);
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                mDisplayRadiance.set(x, y, mTotalRadiance.get(x, y) / static_cast<float>(mCurrentSample));
+            }
+        }
+        mDisplayValid = true;
+    }
+
     void RendererReSTIR::startInitialSampleJob()
     {
         std::unique_ptr<Executor::Job> job = 
@@ -52,9 +171,44 @@ namespace Render::Cpu {
                 [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height(), mSettings.indirectSamples); },
                 [&](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
                     {
+                        Stats::ScopedTimer timer(Stats::Timer::InitialSample);
                         initialSamplePixel(x, y, mCurrentSample, static_cast<ThreadLocal&>(threadLocalBase).sampler);
                     },
-                [&]() { startDirectIlluminateJob(); }
+                [&]()
+                    {
+                        if(mSettings.spatialPasses > 0) {
+                            startSpatialReuseJob(0);
+                        } else {
+                            startDirectIlluminateJob();
+                        }
+                    }
+            );
+
+        mExecutor.runJob(std::move(job));
+    }
+
+    void RendererReSTIR::startSpatialReuseJob(unsigned int pass)
+    {
+        std::unique_ptr<Executor::Job> job = 
+            std::make_unique<RasterJob>(
+                mSettings.width,
+                mSettings.height,
+                1,
+                [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height(), mSettings.indirectSamples); },
+                [&, pass](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
+                    {
+                        Stats::ScopedTimer timer(Stats::Timer::SpatialReuse);
+                        spatialReusePixel(x, y, mCurrentSample, pass, static_cast<ThreadLocal&>(threadLocalBase).sampler);
+                    },
+                [&, pass]()
+                    {
+                        std::swap(mDirectReservoirs, mSpatialDirectReservoirs);
+                        if(pass + 1 < mSettings.spatialPasses) {
+                            startSpatialReuseJob(pass + 1);
+                        } else {
+                            startDirectIlluminateJob();
+                        }
+                    }
             );
 
         mExecutor.runJob(std::move(job));
@@ -70,6 +224,7 @@ namespace Render::Cpu {
                 [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height(), mSettings.indirectSamples); },
                 [&](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
                     {
+                        Stats::ScopedTimer timer(Stats::Timer::DirectIlluminate);
                         directIlluminatePixel(x, y, mCurrentSample, static_cast<ThreadLocal&>(threadLocalBase).sampler);
                     },
                 [&]() { startIndirectIlluminateJob(); }
@@ -88,17 +243,28 @@ namespace Render::Cpu {
                 [&]() { return std::make_unique<ThreadLocal>(mRenderFramebuffer->width(), mRenderFramebuffer->height(), mSettings.indirectSamples); },
                 [&](int x, int y, int sample, Executor::Job::ThreadLocal &threadLocalBase)
                     {
+                        Stats::ScopedTimer timer(Stats::Timer::IndirectIlluminate);
                         indirectIlluminatePixel(x, y, mCurrentSample, static_cast<ThreadLocal&>(threadLocalBase).sampler, &static_cast<ThreadLocal&>(threadLocalBase).indirectSamples[0]);
                     },
                 [&]() 
                     {
                         mCurrentSample++;
-                        if(mCurrentSample < mSettings.samples) {
+                        snapshotRadiance();
+
+                        auto endTime = std::chrono::steady_clock::now();
+                        std::chrono::duration<double> duration = endTime - mStartTime;
+
+                        bool moreSamples;
+                        if(mSettings.timeBudget > 0) {
+                            moreSamples = (mSettings.samples == 0 || mCurrentSample < mSettings.samples) && duration.count() < mSettings.timeBudget;
+                        } else {
+                            moreSamples = mCurrentSample < mSettings.samples;
+                        }
+
+                        if(moreSamples) {
                             startInitialSampleJob();
                         } else {
-                            auto endTime = std::chrono::steady_clock::now();
-                            std::chrono::duration<double> duration = endTime - mStartTime;
-                            mListener->onRendererDone(duration.count());
+                            mListener->onRendererDone(duration.count(), static_cast<float>(mCurrentSample));
                         }
                     }
             );
@@ -109,6 +275,7 @@ namespace Render::Cpu {
     void RendererReSTIR::initialSamplePixel(int x, int y, int sample, Math::Sampler &sampler)
     {
         Math::Bivector dv;
+        Stats::count(Stats::Counter::PrimaryRays);
         sampler.startSample(x, y, sample);
         Math::Point2D imagePoint = Math::Point2D((float)x, (float)y) + sampler.getValue2D();
         Math::Point2D aperturePoint = sampler.getValue2D();
@@ -116,18 +283,26 @@ namespace Render::Cpu {
         Object::Intersection isect = mScene.intersect(beam, FLT_MAX, true);
 
         PrimaryHit &primaryHit = mPrimaryHits.at(x, y);
-        primaryHit.beam = beam;
-        primaryHit.isect = Object::Intersection(mScene, isect.primitive(), primaryHit.beam, isect.shapeIntersection());
-
-        const Math::Normal &nrmFacing = isect.facingNormal(); 
-        const Object::Surface &surface = isect.primitive().surface();
-        Math::Point pntOffset = isect.point() + Math::Vector(nrmFacing) * 0.01f;
-
         Reservoir<DirectSample> &resDirect = mDirectReservoirs.at(x, y);
+        Reservoir<IndirectSample> &resIndirect = mIndirectReservoirs.at(x, y);
+
+        primaryHit.primitive = kInvalidPrimitive;
         resDirect.clear();
+        resIndirect.clear();
 
         Math::Radiance radEmitted;
         if (isect.valid()) {   
+            const Math::Normal &nrmFacing = isect.facingNormal(); 
+            const Object::Surface &surface = isect.primitive().surface();
+            Math::Point pntOffset = isect.point() + Math::Vector(nrmFacing) * 0.01f;
+
+            primaryHit.point = isect.point();
+            primaryHit.distance = isect.distance();
+            primaryHit.normal = encodeOctahedral(Math::Vector(isect.normal()));
+            primaryHit.direction = encodeOctahedral(-beam.ray().direction());
+            primaryHit.albedo = packColor(isect.albedo());
+            primaryHit.primitive = mPrimitiveIndices.at(&isect.primitive());
+
             for(int i=0; i<1; i++) {
                 int lightIndex = (int)std::floor(sampler.getValue() * mScene.areaLights().size());
                 const Object::Primitive &light = mScene.areaLights()[lightIndex];
@@ -157,17 +332,14 @@ namespace Render::Cpu {
                 }
             }
 
-            Reservoir<IndirectSample> &resIndirect = mIndirectReservoirs.at(x, y);           
-            resIndirect.clear();
-
             auto [reflected, dirIn, pdf] = surface.sample(isect, sampler);
             float reverse = (dirIn * nrmFacing > 0) ? 1.0f : -1.0f;
             float dot = dirIn * nrmFacing * reverse;
 
-            Math::Point pntOffset = isect.point() + Math::Vector(nrmFacing) * 0.01f * reverse;
+            Math::Point pntReflect = isect.point() + Math::Vector(nrmFacing) * 0.01f * reverse;
 
             if(dot > 0) {
-                Math::Ray reflectRay(pntOffset, dirIn);
+                Math::Ray reflectRay(pntReflect, dirIn);
                 Math::Beam beam(reflectRay, Math::Bivector(), Math::Bivector());
                 Object::Intersection isect2 = mScene.intersect(beam, FLT_MAX, true);
 
@@ -193,62 +365,122 @@ namespace Render::Cpu {
         addRadiance(x, y, sample, radEmitted);
     }
 
-    void RendererReSTIR::directIlluminatePixel(int x, int y, int sample, Math::Sampler &sampler)
+    Object::Intersection RendererReSTIR::primaryIntersection(const PrimaryHit &primaryHit, Math::Beam &beam) const
     {
-        Math::Radiance radDirect;
-        PrimaryHit &primaryHit = mPrimaryHits.at(x, y);
-        const Math::Normal &nrmFacing = primaryHit.isect.facingNormal(); 
-        const Object::Surface &surface = primaryHit.isect.primitive().surface();
-        Math::Point pntOffset = primaryHit.isect.point() + Math::Vector(nrmFacing) * 0.01f;
+        if(primaryHit.primitive == kInvalidPrimitive) {
+            return Object::Intersection();
+        }
+
+        Math::Vector dirOut = decodeOctahedral(primaryHit.direction);
+        beam = Math::Beam(Math::Ray(primaryHit.point + dirOut * primaryHit.distance, -dirOut), Math::Bivector(), Math::Bivector());
+
+        return Object::Intersection(mScene, *mScene.primitives()[primaryHit.primitive], beam, primaryHit.point, Math::Normal(decodeOctahedral(primaryHit.normal)), unpackColor(primaryHit.albedo));
+    }
+
+    unsigned int RendererReSTIR::neighbourOffsetStart(int x, int y, int sample) const
+    {
+        uint32_t hash = (uint32_t)(x >> 3) * 73856093u ^ (uint32_t)(y >> 3) * 19349663u ^ (uint32_t)sample * 83492791u;
+        hash ^= hash >> 16;
+        hash *= 0x7feb352du;
+        hash ^= hash >> 15;
+
+        return hash % mNeighbourOffsets.size();
+    }
+
+    bool RendererReSTIR::isNeighbourSimilar(const Math::Vector &normal, float distance, const PrimaryHit &neighbour) const
+    {
+        if(neighbour.primitive == kInvalidPrimitive) {
+            return false;
+        }
+
+        if(std::abs(neighbour.distance - distance) > kNeighbourDistanceThreshold * distance) {
+            return false;
+        }
+
+        return decodeFacingNormal(neighbour.normal, neighbour.direction) * normal >= kNeighbourNormalThreshold;
+    }
+
+    float RendererReSTIR::directTarget(const Object::Intersection &isect, const DirectSample &sample, Math::Radiance &radiance) const
+    {
+        const Math::Normal &nrmFacing = isect.facingNormal();
+        Math::Point pntOffset = isect.point() + Math::Vector(nrmFacing) * 0.01f;
+
+        Math::Vector dirIn = sample.point - pntOffset;
+        float d = dirIn.magnitude();
+        dirIn = dirIn / d;
+        float dot = dirIn * nrmFacing;
+        float dot2 = std::abs(dirIn * sample.normal);
+
+        radiance = Math::Radiance();
+        if(dot > 0) {
+            Math::Radiance irad = sample.radiance * dot2 * dot / (d * d);
+            radiance = irad * isect.primitive().surface().reflected(isect, dirIn);
+        }
+
+        return radiance.magnitude();
+    }
+
+    void RendererReSTIR::spatialReusePixel(int x, int y, int sample, unsigned int pass, Math::Sampler &sampler)
+    {
+        const Reservoir<DirectSample> &resCenter = mDirectReservoirs.get(x, y);
+        Reservoir<DirectSample> &res = mSpatialDirectReservoirs.at(x, y);
+        res = resCenter;
+        if(!std::isfinite(res.W) || !std::isfinite(res.q)) {
+            res.clear();
+        }
 
-        Reservoir<DirectSample> res;
-        res.clear();
+        Math::Beam beam;
+        Object::Intersection isect = primaryIntersection(mPrimaryHits.get(x, y), beam);
+        if(!isect.valid()) {
+            return;
+        }
 
-        const int R = mSettings.radius;
+        Math::Vector nrmSurface(isect.facingNormal());
+        unsigned int offsetStart = neighbourOffsetStart(x, y, sample * mSettings.spatialPasses + pass);
         for(int i=0; i<mSettings.candidates; i++) {
-            Math::Point2D s = sampler.getValue2D();
-            s = s * R * 2 + Math::Point2D(-R, -R);
-            int sx = (int)std::floor(s.u() + x);
-            int sy = (int)std::floor(s.v() + y);
-            if(sx < 0 || sy < 0 || sx >= mSettings.width || sy >= mSettings.height) {
+            const NeighbourOffset &offset = mNeighbourOffsets[(offsetStart + i) % mNeighbourOffsets.size()];
+            int sx = x + offset.x;
+            int sy = y + offset.y;
+            if((sx == x && sy == y) || sx < 0 || sy < 0 || sx >= mSettings.width || sy >= mSettings.height) {
                 continue;
             }
-            Reservoir<DirectSample> &resCandidate = mDirectReservoirs.at(sx, sy);
-            if(resCandidate.q == 0) {
+            const PrimaryHit &neighbourHit = mPrimaryHits.get(sx, sy);
+            if(!isNeighbourSimilar(nrmSurface, isect.distance(), neighbourHit)) {
+                Stats::count(Stats::Counter::ReservoirRejections);
                 continue;
             }
-
-            Math::Vector dirIn = resCandidate.sample.point - pntOffset;
-            float d = dirIn.magnitude();
-            dirIn = dirIn / d;
-            float dot = dirIn * nrmFacing;
-            float dot2 = std::abs(dirIn * resCandidate.sample.normal);
-            
-            float q = 0;
-            if(dot > 0) {
-                Math::Radiance irad = resCandidate.sample.radiance * dot2 * dot / (d * d);
-                Math::Radiance rad = irad * surface.reflected(primaryHit.isect, dirIn);
-                q = rad.magnitude();
+            const Reservoir<DirectSample> &resCandidate = mDirectReservoirs.get(sx, sy);
+            if(resCandidate.q == 0) {
+                continue;
             }
 
+            Math::Radiance rad;
+            float q = directTarget(isect, resCandidate.sample, rad);
             res.addReservoir(resCandidate, q, 1.0f, sampler);
-        }            
+        }
+    }
 
-        if(res.W > 0) {
-            Math::Vector dirIn = res.sample.point - pntOffset;
-            float d = dirIn.magnitude();
-            dirIn = dirIn / d;
-            float dot = dirIn * nrmFacing;
-            float dot2 = std::abs(dirIn * res.sample.normal);
+    void RendererReSTIR::directIlluminatePixel(int x, int y, int sample, Math::Sampler &sampler)
+    {
+        Math::Radiance radDirect;
+        Math::Beam beam;
+        Object::Intersection isect = primaryIntersection(mPrimaryHits.get(x, y), beam);
+        if(!isect.valid()) {
+            addRadiance(x, y, sample, radDirect);
+            return;
+        }
 
-            if(dot > 0) {
+        const Reservoir<DirectSample> &res = mDirectReservoirs.get(x, y);
+        if(res.W > 0) {
+            Math::Radiance rad;
+            if(directTarget(isect, res.sample, rad) > 0) {
+                Math::Point pntOffset = isect.point() + Math::Vector(isect.facingNormal()) * 0.01f;
+                Math::Vector dirIn = (res.sample.point - pntOffset).normalize();
                 Math::Ray ray(pntOffset, dirIn);
                 Math::Beam beam(ray, Math::Bivector(), Math::Bivector());
                 Object::Intersection isect2 = mScene.intersect(beam, FLT_MAX, true);
 
                 if (isect2.valid() && &(isect2.primitive()) == res.sample.primitive) {
-                    Math::Radiance irad = res.sample.radiance * dot2 * dot / (d * d);
-                    Math::Radiance rad = irad * surface.reflected(primaryHit.isect, dirIn);
                     radDirect = rad * res.W;
                 }
             }
@@ -260,32 +492,43 @@ namespace Render::Cpu {
     void RendererReSTIR::indirectIlluminatePixel(int x, int y, int sample, Math::Sampler &sampler, Reservoir<IndirectSample> indirectSamples[])
     {
         Math::Radiance radIndirect;
-        PrimaryHit &primaryHit = mPrimaryHits.at(x, y);
-        const Math::Normal &nrmFacing = primaryHit.isect.facingNormal(); 
-        const Object::Surface &surface = primaryHit.isect.primitive().surface();
+        Math::Beam beam;
+        Object::Intersection isect = primaryIntersection(mPrimaryHits.get(x, y), beam);
+        if(!isect.valid()) {
+            addRadiance(x, y, sample, radIndirect);
+            return;
+        }
+
+        const Math::Normal &nrmFacing = isect.facingNormal(); 
+        const Object::Surface &surface = isect.primitive().surface();
 
         const int N = mSettings.indirectSamples;
         for(int i=0; i<N; i++) {
             indirectSamples[i].clear();
         }
 
-        const int R = mSettings.radius;
+        Math::Vector nrmSurface(nrmFacing);
+        unsigned int offsetStart = neighbourOffsetStart(x, y, sample);
         for(int i=0; i<mSettings.candidates; i++) {
-            Math::Point2D s = sampler.getValue2D();
-            s = s * R * 2 + Math::Point2D(-R, -R);
-            int sx = (int)std::floor(s.u() + x);
-            int sy = (int)std::floor(s.v() + y);
+            const NeighbourOffset &offset = mNeighbourOffsets[(offsetStart + i) % mNeighbourOffsets.size()];
+            int sx = x + offset.x;
+            int sy = y + offset.y;
             if(sx < 0 || sy < 0 || sx >= mSettings.width || sy >= mSettings.height) {
                 continue;
             }
+            const PrimaryHit &neighbourHit = mPrimaryHits.get(sx, sy);
+            if(!isNeighbourSimilar(nrmSurface, isect.distance(), neighbourHit)) {
+                Stats::count(Stats::Counter::ReservoirRejections);
+                continue;
+            }
             Reservoir<IndirectSample> &resCandidate = mIndirectReservoirs.at(sx, sy);
             if(resCandidate.q == 0) {
                 continue;
             }
 
             for(int i=0; i<N; i++) {
-                Math::Vector r = resCandidate.sample.point - primaryHit.isect.point();
-                Math::Vector q = resCandidate.sample.point - mPrimaryHits.at(sx, sy).isect.point();
+                Math::Vector r = resCandidate.sample.point - isect.point();
+                Math::Vector q = resCandidate.sample.point - neighbourHit.point;
                 Math::Normal &n = resCandidate.sample.normal;
                 float J = std::fabs((n * r) * q.magnitude2() / ((n * q) * r.magnitude2()));
                 indirectSamples[i].addReservoir(resCandidate, resCandidate.q, J, sampler);
@@ -295,13 +538,13 @@ namespace Render::Cpu {
         for(int i=0; i<N; i++) {
             if(indirectSamples[i].W > 0) {
                 float q = indirectSamples[i].sample.indirectRadiance.magnitude();
-                Math::Vector dirIn = indirectSamples[i].sample.point - primaryHit.isect.point();
+                Math::Vector dirIn = indirectSamples[i].sample.point - isect.point();
                 float d = dirIn.magnitude();
                 dirIn = dirIn / d;
                 float dot = dirIn * nrmFacing;
                 
                 if(dot > 0) {
-                    Math::Color reflected = surface.reflected(primaryHit.isect, dirIn);
+                    Math::Color reflected = surface.reflected(isect, dirIn);
                     radIndirect += indirectSamples[i].sample.indirectRadiance * dot * reflected * indirectSamples[i].W;
                 }
             }
@@ -312,9 +555,6 @@ namespace Render::Cpu {
 
     void RendererReSTIR::addRadiance(int x, int y, int sample, const Math::Radiance &radiance)
     {
-        Math::Radiance radTotal = mTotalRadiance.get(x, y) + radiance;
-        mTotalRadiance.set(x, y, radTotal);
-        Math::Color color = Framebuffer::toneMap(radTotal / static_cast<float>(sample + 1));
-        mRenderFramebuffer->setPixel(x, y, color);
+        mTotalRadiance.at(x, y) += radiance;
     }
 }
\ No newline at end of file
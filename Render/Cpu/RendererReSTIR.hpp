@@ -6,6 +6,7 @@
 #include "Render/Cpu/Executor.hpp"
 #include "Render/Framebuffer.hpp"
 #include "Render/Raster.hpp"
+#include "Render/TiledRaster.hpp"
 
 #include "Render/Cpu/Impl/Lighter/UniPath.hpp"
 #include "Math/Impl/Sampler/Halton.hpp"
@@ -14,6 +15,11 @@
 
 #include <memory>
 #include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <atomic>
+#include <cmath>
+#include <mutex>
 
 namespace Render::Cpu {
     class RendererReSTIR : public Render::Renderer {
@@ -26,6 +32,8 @@ namespace Render::Cpu {
             unsigned int indirectSamples;
             unsigned int radius;
             unsigned int candidates;
+            unsigned int spatialPasses;
+            float timeBudget;
         };
         RendererReSTIR(const Object::Scene &scene, const Settings &settings);
 
@@ -34,6 +42,8 @@ namespace Render::Cpu {
         bool running() override;
 
         Render::Framebuffer &renderFramebuffer() override;
+        void updateFramebuffer() override;
+        Math::Radiance radiance(unsigned int x, unsigned int y) override;
 
     private:
         template<typename T> struct Reservoir {
@@ -62,6 +72,10 @@ namespace Render::Cpu {
         private:
             void combine(const T &sampleNew, float qNew, float WNew, int MNew, float J, Math::Sampler &sampler)
             {
+                if(M + MNew == 0) {
+                    return;
+                }
+
                 float m0 = (float)M / (float)(M + MNew);
                 float m1 = (float)MNew / (float)(M + MNew);
 
@@ -75,7 +89,10 @@ namespace Render::Cpu {
                 }
 
                 M += MNew;
-                W = wSum / q;
+                W = (q > 0 && wSum > 0) ? wSum / q : 0;
+                if(!std::isfinite(W)) {
+                    W = 0;
+                }
             }
         };
 
@@ -93,13 +110,16 @@ namespace Render::Cpu {
         };
 
         void startInitialSampleJob();
+        void startSpatialReuseJob(unsigned int pass);
         void startDirectIlluminateJob();
         void startIndirectIlluminateJob();
         void initialSamplePixel(int x, int y, int sample, Math::Sampler &sampler);
+        void spatialReusePixel(int x, int y, int sample, unsigned int pass, Math::Sampler &sampler);
         void directIlluminatePixel(int x, int y, int sample, Math::Sampler &sampler);
         void indirectIlluminatePixel(int x, int y, int sample, Math::Sampler &sampler, Reservoir<IndirectSample> indirectSamples[]);
 
         void addRadiance(int x, int y, int sample, const Math::Radiance &radiance);
+        void snapshotRadiance();
 
         Executor mExecutor;
         Listener *mListener;
@@ -112,16 +132,37 @@ namespace Render::Cpu {
 
         std::unique_ptr<Render::Cpu::Lighter> mIndirectLighter;
 
-        Render::Raster<Reservoir<DirectSample>> mDirectReservoirs;
-        Render::Raster<Reservoir<IndirectSample>> mIndirectReservoirs;
+        Render::TiledRaster<Reservoir<DirectSample>> mDirectReservoirs;
+        Render::TiledRaster<Reservoir<IndirectSample>> mIndirectReservoirs;
+        Render::TiledRaster<Reservoir<DirectSample>> mSpatialDirectReservoirs;
 
         struct PrimaryHit {
-            Object::Intersection isect;
-            Math::Beam beam;
+            Math::Point point;
+            float distance;
+            uint32_t normal;
+            uint32_t direction;
+            uint32_t albedo;
+            uint32_t primitive;
         };
-        Render::Raster<PrimaryHit> mPrimaryHits;
+        Render::TiledRaster<PrimaryHit> mPrimaryHits;
+        std::unordered_map<const Object::Primitive*, uint32_t> mPrimitiveIndices;
+
+        Object::Intersection primaryIntersection(const PrimaryHit &primaryHit, Math::Beam &beam) const;
+
+        struct NeighbourOffset {
+            int x;
+            int y;
+        };
+        std::vector<NeighbourOffset> mNeighbourOffsets;
+
+        unsigned int neighbourOffsetStart(int x, int y, int sample) const;
+        bool isNeighbourSimilar(const Math::Vector &normal, float distance, const PrimaryHit &neighbour) const;
+        float directTarget(const Object::Intersection &isect, const DirectSample &sample, Math::Radiance &radiance) const;
 
         Render::Raster<Math::Radiance> mTotalRadiance;
+        Render::Raster<Math::Radiance, Render::HalfRadianceStorage> mDisplayRadiance;
+        bool mDisplayValid;
+        std::mutex mDisplayMutex;
 
         struct ThreadLocal : public Executor::Job::ThreadLocal {
             Math::Impl::Sampler::Halton sampler;
@@ -27,6 +27,11 @@ namespace Render {
         return &mBits[0];
     }
 
+    unsigned char *Framebuffer::bits()
+    {
+        return &mBits[0];
+    }
+
     void Framebuffer::setPixel(unsigned int x, unsigned int y, const Math::Color &color)
     {
         mBits[(mWidth * y + x) * 3 + 0] = static_cast<unsigned char>(color.red() * 0xff);
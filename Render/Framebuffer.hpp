@@ -15,6 +15,7 @@ namespace Render {
         unsigned int width() const;
         unsigned int height() const;
         const unsigned char *bits() const;
+        unsigned char *bits();
 
         void setPixel(unsigned int x, unsigned int y, const Math::Color &color);
 
@@ -5,8 +5,6 @@ typedef struct {
 } Settings;
 
 typedef struct {
-    Beam beam;
-    Intersection isect;
     bool specularBounce;
     int generation;
     float pdf;
@@ -15,17 +13,32 @@ typedef struct {
     int lightIndex;
     int x;
     int y;
-    SamplerState samplerState;
-} Item;
+} PathState;
+
+typedef struct {
+    Ray ray;
+    float distance;
+    Primitive *light;
+    Radiance radiance;
+} ShadowRay;
 
 typedef struct {
     global int *data;
 } WorkQueue;
 
+typedef struct {
+    int numRays;
+    unsigned int currentPixel;
+} Status;
+
 typedef struct {
     Scene scene;
     Settings settings;
-    Item *items;
+    Beam *beams;
+    Intersection *isects;
+    PathState *paths;
+    SamplerState *samplerStates;
+    ShadowRay *shadowRays;
     unsigned int currentPixel;
     Sampler sampler;
 
@@ -35,6 +48,19 @@ typedef struct {
     WorkQueue directLightPointQueue;
     WorkQueue extendPathQueue;
     WorkQueue commitRadianceQueue;
+    WorkQueue shadowRayQueue;
+
+    global float *totalRadiance;
+    global int *totalSamples;
+    Status status;
+
+    global int *materialCounts;
+    global int *materialOffsets;
+    global int *sortedKeys;
+
+    global int *tiles;
+    int tileSize;
+    int numTileSlots;
 } Context;
 
 void Queue_addItem(WorkQueue *queue, int key)
@@ -60,6 +86,19 @@ void Queue_clear(WorkQueue *queue)
     queue->data[1] = 0;
 }
 
+void atomicAddFloat(global float *address, float value)
+{
+    union {
+        unsigned int u;
+        float f;
+    } oldValue, newValue;
+
+    do {
+        oldValue.f = *address;
+        newValue.f = oldValue.f + value;
+    } while(atomic_cmpxchg((global unsigned int*)address, oldValue.u, newValue.u) != oldValue.u);
+}
+
 void createPixelBeam(Camera *camera, float2 imagePoint, int width, int height, float2 aperturePoint, Beam *beam)
 {
     float cx = (2 * imagePoint.x - width) / width;
@@ -88,123 +127,139 @@ void createPixelBeam(Camera *camera, float2 imagePoint, int width, int height, f
     beam->directionDifferential.v = camera->imagePlane.v * pixelSize / len;
 }
 
-kernel void generateCameraRays(global Context *context)
+void generateCameraRay(global Context *context, int key)
 {
-    int key = Queue_getKey(&context->generateCameraRayQueue, get_global_id(0));
-    Item *item = &context->items[key];
+    PathState *path = &context->paths[key];
+    SamplerState *samplerState = &context->samplerStates[key];
+    Beam *beam = &context->beams[key];
 
     unsigned int cp = atomic_inc(&context->currentPixel);
+    int tile = context->tiles[(cp / context->tileSize) % context->numTileSlots];
+    if(tile < 0) {
+        return;
+    }
 
-    int sample = cp / (context->settings.width * context->settings.height);
+    unsigned int pixel = (unsigned int)tile * context->tileSize + cp % context->tileSize;
+    int sample = pixel / (context->settings.width * context->settings.height);
     if(sample >= context->settings.samples) {
         return;
     }
 
-    item->y = (cp / context->settings.width) % context->settings.height;
-    item->x = cp % context->settings.width;
-    Sampler_startSample(&context->sampler, &item->samplerState, item->x, item->y, sample);
+    path->y = (pixel / context->settings.width) % context->settings.height;
+    path->x = pixel % context->settings.width;
+    Sampler_startSample(&context->sampler, samplerState, path->x, path->y, sample);
 
-    float2 imagePoint = (float2)(item->x, item->y) + Sampler_getValue2D(&context->sampler, &item->samplerState);
-    float2 aperturePoint = Sampler_getValue2D(&context->sampler, &item->samplerState);
-    createPixelBeam(&context->scene.camera, imagePoint, context->settings.width, context->settings.height, aperturePoint, &item->beam);
-    item->specularBounce = false;
-    item->generation = 0;
-    item->radiance = (Radiance)(0, 0, 0);
-    item->throughput = (Color)(1, 1, 1);
+    float2 imagePoint = (float2)(path->x, path->y) + Sampler_getValue2D(&context->sampler, samplerState);
+    float2 aperturePoint = Sampler_getValue2D(&context->sampler, samplerState);
+    createPixelBeam(&context->scene.camera, imagePoint, context->settings.width, context->settings.height, aperturePoint, beam);
+    path->specularBounce = false;
+    path->generation = 0;
+    path->radiance = (Radiance)(0, 0, 0);
+    path->throughput = (Color)(1, 1, 1);
 
     Queue_addItem(&context->intersectRaysQueue, key);
 }
 
-kernel void intersectRays(global Context *context)
+void intersectRay(global Context *context, int key)
 {
-    int key = Queue_getKey(&context->intersectRaysQueue, get_global_id(0));
-    Item *item = &context->items[key];
+    Beam *beam = &context->beams[key];
+    Intersection *isect = &context->isects[key];
+    PathState *path = &context->paths[key];
+    SamplerState *samplerState = &context->samplerStates[key];
 
-    Scene_intersect(&context->scene, &item->beam, &item->isect, MAXFLOAT, true);
+    Scene_intersect(&context->scene, beam, isect, MAXFLOAT, true);
 
-    if(item->isect.primitive == NULL) {
+    if(isect->primitive == NULL) {
         Radiance rad2 = context->scene.skyRadiance;
-        item->radiance += rad2 * item->throughput;
+        path->radiance += rad2 * path->throughput;
         Queue_addItem(&context->commitRadianceQueue, key);
     } else {
-        Radiance rad2 = item->isect.primitive->surface.radiance;
+        Radiance rad2 = isect->primitive->surface.radiance;
+        int totalLights = context->scene.numAreaLights + context->scene.numPointLights;
         float misWeight = 1.0f;
-        if(length(rad2) > 0 && !item->specularBounce && item->generation > 0) {
-            Normal nrmFacing = item->isect.facingNormal;
-            float dot2 = -dot(nrmFacing, item->beam.ray.direction);
-            float d = item->isect.shapeIntersection.distance;
-            float pdfArea = item->pdf * dot2 / (d * d);
-            float pdfLight = Shape_samplePdf(&item->isect.primitive->shape, item->isect.point);
+        if(length(rad2) > 0 && !path->specularBounce && path->generation > 0) {
+            Normal nrmFacing = isect->facingNormal;
+            float dot2 = -dot(nrmFacing, beam->ray.direction);
+            float d = isect->shapeIntersection.distance;
+            float pdfArea = path->pdf * dot2 / (d * d);
+            float pdfLight = Shape_samplePdf(&isect->primitive->shape, isect->point) / totalLights;
             misWeight = pdfArea * pdfArea / (pdfArea * pdfArea + pdfLight * pdfLight);
         }
 
-        item->radiance += rad2 * item->throughput * misWeight;        
-    
-        int totalLights = context->scene.numAreaLights + context->scene.numPointLights;
-        int lightIndex = (int)floor(Sampler_getValue(&context->sampler, &item->samplerState) * totalLights);
+        path->radiance += rad2 * path->throughput * misWeight;        
+
+        if(totalLights == 0) {
+            Queue_addItem(&context->extendPathQueue, key);
+            return;
+        }
+
+        int lightIndex = min((int)floor(Sampler_getValue(&context->sampler, samplerState) * totalLights), totalLights - 1);
 
         if(lightIndex < context->scene.numAreaLights) {
-            item->lightIndex = lightIndex;
+            path->lightIndex = lightIndex;
             Queue_addItem(&context->directLightAreaQueue, key);
         } else {
-            item->lightIndex = lightIndex - context->scene.numAreaLights;
+            path->lightIndex = lightIndex - context->scene.numAreaLights;
             Queue_addItem(&context->directLightPointQueue, key);
         }
     }
 }
 
-kernel void directLightArea(global Context *context)
+void directLightAreaItem(global Context *context, int key)
 {
-    int key = Queue_getKey(&context->directLightAreaQueue, get_global_id(0));
-    Item *item = &context->items[key];
+    Intersection *isect = &context->isects[key];
+    PathState *path = &context->paths[key];
+    SamplerState *samplerState = &context->samplerStates[key];
+    ShadowRay *shadowRay = &context->shadowRays[key];
 
-    Intersection *isect = &item->isect;
     Normal nrmFacing = isect->facingNormal;
     Point pntOffset = isect->point + nrmFacing * 0.01f;
 
-    Primitive *light = context->scene.areaLights[item->lightIndex];
+    Primitive *light = context->scene.areaLights[path->lightIndex];
+    int totalLights = context->scene.numAreaLights + context->scene.numPointLights;
 
-    float2 rand = Sampler_getValue2D(&context->sampler, &item->samplerState);
+    float2 rand = Sampler_getValue2D(&context->sampler, samplerState);
     Point pnt2;
     Normal nrm2;
     float pdf;
     if(Shape_sample(&light->shape, rand, &pnt2, &nrm2, &pdf)) {
+        // One light is picked uniformly per vertex, so fold the selection probability into the pdf
+        pdf /= totalLights;
         Vector dirIn = pnt2 - pntOffset;
         float d = length(dirIn);
         dirIn = dirIn / d;
         float dot2 = fabs(dot(dirIn, nrm2));
         float dt = dot(dirIn, nrmFacing);
         if(dt > 0) {    
-            Beam shadowBeam;
-            shadowBeam.ray.origin = pntOffset;
-            shadowBeam.ray.direction = dirIn;
-
-            Intersection shadowIsect;
-            Scene_intersect(&context->scene, &shadowBeam, &shadowIsect, d, false);
-
-            if(shadowIsect.primitive == NULL || shadowIsect.primitive == light) {
-                Radiance rad2 = light->surface.radiance;
-                Radiance irad = rad2 * dot2 * dt / (d * d * pdf);
-                float pdfBrdf = Surface_pdf(isect, dirIn) * dot2 / (d * d);
-                float misWeight = pdf * pdf / (pdf * pdf + pdfBrdf * pdfBrdf);
-                Radiance rad = irad * Surface_reflected(isect, dirIn);
-                item->radiance += rad * item->throughput * misWeight;
-            }
+            Radiance rad2 = light->surface.radiance;
+            Radiance irad = rad2 * dot2 * dt / (d * d * pdf);
+            float pdfBrdf = Surface_pdf(isect, dirIn) * dot2 / (d * d);
+            float misWeight = pdf * pdf / (pdf * pdf + pdfBrdf * pdfBrdf);
+            Radiance rad = irad * Surface_reflected(isect, dirIn);
+
+            shadowRay->ray.origin = pntOffset;
+            shadowRay->ray.direction = dirIn;
+            shadowRay->distance = d;
+            shadowRay->light = light;
+            shadowRay->radiance = rad * path->throughput * misWeight;
+            Queue_addItem(&context->shadowRayQueue, key);
+            return;
         }
     }
 
     Queue_addItem(&context->extendPathQueue, key);
 }
 
-kernel void directLightPoint(global Context *context)
+void directLightPointItem(global Context *context, int key)
 {
-    int key = Queue_getKey(&context->directLightPointQueue, get_global_id(0));
-    Item *item = &context->items[key];
+    Intersection *isect = &context->isects[key];
+    PathState *path = &context->paths[key];
+    ShadowRay *shadowRay = &context->shadowRays[key];
 
-    Intersection *isect = &item->isect;
     Normal nrmFacing = isect->facingNormal;
     Point pntOffset = isect->point + nrmFacing * 0.01f;
-    PointLight *pointLight = &context->scene.pointLights[item->lightIndex];
+    PointLight *pointLight = &context->scene.pointLights[path->lightIndex];
+    int totalLights = context->scene.numAreaLights + context->scene.numPointLights;
 
     Vector dirIn = pointLight->position - pntOffset;
     float d = length(dirIn);
@@ -212,60 +267,71 @@ kernel void directLightPoint(global Context *context)
 
     float dt = dot(dirIn, nrmFacing);
     if(dt > 0) {
-        Beam shadowBeam;
-        shadowBeam.ray.origin = pntOffset;
-        shadowBeam.ray.direction = dirIn;
+        Radiance irad = pointLight->radiance * dt * totalLights / (d * d);
+        Radiance rad = irad * Surface_reflected(isect, dirIn);
+
+        shadowRay->ray.origin = pntOffset;
+        shadowRay->ray.direction = dirIn;
+        shadowRay->distance = d;
+        shadowRay->light = NULL;
+        shadowRay->radiance = rad * path->throughput;
+        Queue_addItem(&context->shadowRayQueue, key);
+        return;
+    }
+
+    Queue_addItem(&context->extendPathQueue, key);
+}
 
-        Intersection shadowIsect;
-        Scene_intersect(&context->scene, &shadowBeam, &shadowIsect, d, false);
+void traceShadowRay(global Context *context, int key)
+{
+    PathState *path = &context->paths[key];
+    ShadowRay *shadowRay = &context->shadowRays[key];
 
-        if(shadowIsect.primitive == NULL) {
-            Radiance irad = pointLight->radiance * dt / (d * d);
-            Radiance rad = irad * Surface_reflected(isect, dirIn);
-            item->radiance += rad * item->throughput;
-        }
+    if(!Scene_occluded(&context->scene, &shadowRay->ray, shadowRay->distance, shadowRay->light)) {
+        path->radiance += shadowRay->radiance;
     }
 
     Queue_addItem(&context->extendPathQueue, key);
 }
 
-kernel void extendPath(global Context *context)
+void extendPathItem(global Context *context, int key)
 {
-    int key = Queue_getKey(&context->extendPathQueue, get_global_id(0));
-    Item *item = &context->items[key];
-    Intersection *isect = &item->isect;
+    Intersection *isect = &context->isects[key];
+    PathState *path = &context->paths[key];
+    SamplerState *samplerState = &context->samplerStates[key];
+    Beam *beam = &context->beams[key];
     Normal nrmFacing = isect->facingNormal;
     
     Vector dirIn;
     float pdf;
     bool pdfDelta;
     
-    Color reflected = Surface_sample(isect, &context->sampler, &item->samplerState, &dirIn, &pdf, &pdfDelta);
+    Color reflected = Surface_sample(isect, &context->sampler, samplerState, &dirIn, &pdf, &pdfDelta);
 
     float dt = dot(dirIn, nrmFacing);
     float reverse = (dt > 0) ? 1.0f : -1.0f;
     dt *= reverse;
     Point pntOffset = isect->point + nrmFacing * 0.01f * reverse;
     
-    item->pdf = pdf;
-    item->specularBounce = pdfDelta;
+    path->pdf = pdf;
+    path->specularBounce = pdfDelta;
     if(dt > 0) {
-        item->throughput = item->throughput * reflected * dt / pdf;
+        path->throughput = path->throughput * reflected * dt / pdf;
 
         float threshold = 0.0f;
-        float roulette = Sampler_getValue(&context->sampler, &item->samplerState);
-        if(item->generation == 0) {
+        float roulette = Sampler_getValue(&context->sampler, samplerState);
+        if(path->generation == 0) {
             threshold = 1.0f;
-        } else if(item->generation < 10) {
-            float tmax = max(item->throughput.x, max(item->throughput.y, item->throughput.z));
+        } else if(path->generation < 10) {
+            float tmax = max(path->throughput.x, max(path->throughput.y, path->throughput.z));
             threshold = min(1.0f, tmax);
         }
 
         if(roulette < threshold) {
-            item->beam.ray.origin = pntOffset;
-            item->beam.ray.direction = dirIn;
-            item->throughput = item->throughput / threshold;
-            item->generation++;
+            beam->ray.origin = pntOffset;
+            beam->ray.direction = dirIn;
+            path->throughput = path->throughput / threshold;
+            path->generation++;
             Queue_addItem(&context->intersectRaysQueue, key);
         } else {
             Queue_addItem(&context->commitRadianceQueue, key);
@@ -274,3 +340,131 @@ kernel void extendPath(global Context *context)
         Queue_addItem(&context->commitRadianceQueue, key);
     }
 }
+
+kernel void generateCameraRays(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->generateCameraRayQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        generateCameraRay(context, Queue_getKey(&context->generateCameraRayQueue, idx));
+    }
+}
+
+kernel void intersectRays(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->intersectRaysQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        intersectRay(context, Queue_getKey(&context->intersectRaysQueue, idx));
+    }
+}
+
+kernel void directLightArea(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->directLightAreaQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        directLightAreaItem(context, Queue_getKey(&context->directLightAreaQueue, idx));
+    }
+}
+
+kernel void directLightPoint(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->directLightPointQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        directLightPointItem(context, Queue_getKey(&context->directLightPointQueue, idx));
+    }
+}
+
+kernel void traceShadowRays(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->shadowRayQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        traceShadowRay(context, Queue_getKey(&context->shadowRayQueue, idx));
+    }
+}
+
+kernel void extendPath(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->extendPathQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        extendPathItem(context, Queue_getKey(&context->extendPathQueue, idx));
+    }
+}
+
+kernel void countMaterials(global Context *context, global int *queueData)
+{
+    WorkQueue queue;
+    queue.data = queueData;
+
+    int numQueued = Queue_numQueued(&queue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        Intersection *isect = &context->isects[Queue_getKey(&queue, idx)];
+        atomic_inc(&context->materialCounts[Surface_sortKey(&isect->primitive->surface)]);
+    }
+}
+
+kernel void scatterMaterials(global Context *context, global int *queueData)
+{
+    WorkQueue queue;
+    queue.data = queueData;
+
+    int numQueued = Queue_numQueued(&queue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        int key = Queue_getKey(&queue, idx);
+        int bucket = Surface_sortKey(&context->isects[key].primitive->surface);
+
+        int offset = 0;
+        for(int i=0; i<bucket; i++) {
+            offset += context->materialCounts[i];
+        }
+        offset += atomic_inc(&context->materialOffsets[bucket]);
+
+        context->sortedKeys[offset] = key;
+    }
+}
+
+kernel void gatherMaterials(global Context *context, global int *queueData)
+{
+    WorkQueue queue;
+    queue.data = queueData;
+
+    int numQueued = Queue_numQueued(&queue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        queue.data[idx + 2] = context->sortedKeys[idx];
+    }
+}
+
+kernel void commitRadiance(global Context *context)
+{
+    int numQueued = Queue_numQueued(&context->commitRadianceQueue);
+    for(int idx = get_global_id(0); idx < numQueued; idx += get_global_size(0)) {
+        int key = Queue_getKey(&context->commitRadianceQueue, idx);
+        PathState *path = &context->paths[key];
+        int pixel = path->y * context->settings.width + path->x;
+
+        atomicAddFloat(&context->totalRadiance[pixel * 3 + 0], path->radiance.x);
+        atomicAddFloat(&context->totalRadiance[pixel * 3 + 1], path->radiance.y);
+        atomicAddFloat(&context->totalRadiance[pixel * 3 + 2], path->radiance.z);
+        atomic_inc(&context->totalSamples[pixel]);
+
+        Queue_addItem(&context->generateCameraRayQueue, key);
+    }
+}
+
+kernel void updateStatus(global Context *context)
+{
+    context->status.numRays = Queue_numQueued(&context->generateCameraRayQueue) + Queue_numQueued(&context->intersectRaysQueue);
+    context->status.currentPixel = context->currentPixel;
+}
+
+kernel void toneMap(global Context *context, global uchar *framebuffer)
+{
+    int pixel = get_global_id(0);
+    int numSamples = context->totalSamples[pixel];
+
+    Radiance rad = (Radiance)(0, 0, 0);
+    if(numSamples > 0) {
+        rad = (Radiance)(context->totalRadiance[pixel * 3 + 0], context->totalRadiance[pixel * 3 + 1], context->totalRadiance[pixel * 3 + 2]) / numSamples;
+    }
+
+    Color color = rad / (rad + 1);
+    vstore3(convert_uchar3(color * 0xff), pixel, framebuffer);
+}
@@ -13,9 +13,7 @@ struct SettingsProxy {
     int samples;
 };
 
-struct ItemProxy {
-    BeamProxy beam;
-    IntersectionProxy isect;
+struct PathStateProxy {
     bool specularBounce;
     int generation;
     float pdf;
@@ -24,17 +22,32 @@ struct ItemProxy {
     int lightIndex;
     int x;
     int y;
-    SamplerStateProxy samplerState;
+};
+
+struct ShadowRayProxy {
+    RayProxy ray;
+    float distance;
+    PrimitiveProxy *light;
+    RadianceProxy radiance;
 };
 
 struct WorkQueueProxy {
     int *data;
 };
 
+struct StatusProxy {
+    int numRays;
+    unsigned int currentPixel;
+};
+
 struct ContextProxy {
     SceneProxy scene;
     SettingsProxy settings;
-    ItemProxy *items;
+    BeamProxy *beams;
+    IntersectionProxy *isects;
+    PathStateProxy *paths;
+    SamplerStateProxy *samplerStates;
+    ShadowRayProxy *shadowRays;
     unsigned int currentPixel;
     SamplerProxy sampler;
 
@@ -44,6 +57,19 @@ struct ContextProxy {
     WorkQueueProxy directLightPointQueue;
     WorkQueueProxy extendPathQueue;
     WorkQueueProxy commitRadianceQueue;
+    WorkQueueProxy shadowRayQueue;
+
+    float *totalRadiance;
+    int *totalSamples;
+    StatusProxy status;
+
+    int *materialCounts;
+    int *materialOffsets;
+    int *sortedKeys;
+
+    int *tiles;
+    int tileSize;
+    int numTileSlots;
 };
 
 #endif
\ No newline at end of file
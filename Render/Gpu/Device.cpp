@@ -0,0 +1,291 @@
+#include "Render/Gpu/Device.hpp"
+
+#include "Math/Impl/Sampler/Halton.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Render::Gpu {
+    static const int kMaxItems = 1000000;
+    static const float kItemMemoryFraction = 0.5f;
+    static const int kItemsPerComputeUnit = 4096;
+    static const int kCpuItemsPerComputeUnit = 1024;
+    // Surface_sortKey packs the opacity into bit 0 and one bit per BRDF type above it
+    static const int kNumMaterialBuckets = 2 << BrdfProxy::NumTypes;
+    static const int kTileLookahead = 3;
+
+    static int itemCapacity(OpenCL::Context &context)
+    {
+        cl_ulong globalMemSize = 0;
+        cl_ulong maxAllocSize = 0;
+        clGetDeviceInfo(context.clDevice(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemSize), &globalMemSize, NULL);
+        clGetDeviceInfo(context.clDevice(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAllocSize), &maxAllocSize, NULL);
+        if(globalMemSize == 0 || maxAllocSize == 0) {
+            return kMaxItems;
+        }
+
+        size_t itemSize = sizeof(BeamProxy) + sizeof(IntersectionProxy) + sizeof(PathStateProxy) + sizeof(SamplerStateProxy) + sizeof(ShadowRayProxy) + 8 * sizeof(WorkQueue::Key);
+        cl_ulong numItems = static_cast<cl_ulong>(globalMemSize * kItemMemoryFraction) / itemSize;
+        numItems = std::min(numItems, maxAllocSize / sizeof(IntersectionProxy));
+
+        return static_cast<int>(std::min(numItems, static_cast<cl_ulong>(kMaxItems)));
+    }
+
+    Device::Device(const Object::Scene &scene, const std::string &selector, unsigned int width, unsigned int height, int tileSize)
+    : mWidth(width)
+    , mHeight(height)
+    , mClContext(selector)
+    , mClConstAllocator(mClContext)
+    , mClRwAllocator(mClContext)
+    , mClProgram(mClContext, getSourceList())
+    , mClGenerateCameraRaysKernel(mClProgram, "generateCameraRays", mClConstAllocator, mClRwAllocator)
+    , mClIntersectRaysKernel(mClProgram, "intersectRays", mClConstAllocator, mClRwAllocator)
+    , mClDirectLightAreaKernel(mClProgram, "directLightArea", mClConstAllocator, mClRwAllocator)
+    , mClDirectLightPointKernel(mClProgram, "directLightPoint", mClConstAllocator, mClRwAllocator)
+    , mClTraceShadowRaysKernel(mClProgram, "traceShadowRays", mClConstAllocator, mClRwAllocator)
+    , mClExtendPathKernel(mClProgram, "extendPath", mClConstAllocator, mClRwAllocator)
+    , mClCommitRadianceKernel(mClProgram, "commitRadiance", mClConstAllocator, mClRwAllocator)
+    , mClUpdateStatusKernel(mClProgram, "updateStatus", mClConstAllocator, mClRwAllocator)
+    , mClToneMapKernel(mClProgram, "toneMap", mClConstAllocator, mClRwAllocator)
+    , mClCountMaterialsKernel(mClProgram, "countMaterials", mClConstAllocator, mClRwAllocator)
+    , mClScatterMaterialsKernel(mClProgram, "scatterMaterials", mClConstAllocator, mClRwAllocator)
+    , mClGatherMaterialsKernel(mClProgram, "gatherMaterials", mClConstAllocator, mClRwAllocator)
+    {
+        mTileSize = tileSize;
+
+        cl_uint computeUnits = 1;
+        clGetDeviceInfo(mClContext.clDevice(), CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+        mNumItems = itemCapacity(mClContext);
+        if(mClContext.cpuDevice()) {
+            mNumItems = std::min(mNumItems, static_cast<int>(computeUnits) * kCpuItemsPerComputeUnit);
+        }
+        mLaunchSize = std::min(mNumItems, static_cast<int>(computeUnits) * kItemsPerComputeUnit);
+        mNumTileSlots = (kTileLookahead * mNumItems + mTileSize - 1) / mTileSize + 2;
+        mHostTiles.resize(mNumTileSlots, -1);
+
+        mClRwAllocator.mapAreas();
+        mClConstAllocator.mapAreas();
+        mContextProxy = mClRwAllocator.allocate<ContextProxy>();
+
+        scene.writeProxy(mContextProxy->scene, mClConstAllocator);
+        mContextProxy->settings.width = mWidth;
+        mContextProxy->settings.height = mHeight;
+        mContextProxy->settings.samples = 0;
+
+        Math::Impl::Sampler::Halton sampler(mWidth, mHeight);
+        sampler.writeProxy(mContextProxy->sampler, mClConstAllocator);
+        mContextProxy->beams = mClRwAllocator.allocateArray<BeamProxy>(mNumItems);
+        mContextProxy->isects = mClRwAllocator.allocateArray<IntersectionProxy>(mNumItems);
+        mContextProxy->paths = mClRwAllocator.allocateArray<PathStateProxy>(mNumItems);
+        mContextProxy->samplerStates = mClRwAllocator.allocateArray<SamplerStateProxy>(mNumItems);
+        mContextProxy->shadowRays = mClRwAllocator.allocateArray<ShadowRayProxy>(mNumItems);
+        mTotalRadianceBuffer = mClRwAllocator.allocateArray<float>(mWidth * mHeight * 3);
+        mTotalSamplesBuffer = mClRwAllocator.allocateArray<int>(mWidth * mHeight);
+        mContextProxy->totalRadiance = mTotalRadianceBuffer;
+        mContextProxy->totalSamples = mTotalSamplesBuffer;
+        mFramebufferBuffer = mClRwAllocator.allocateArray<unsigned char>(mWidth * mHeight * 3);
+        mMaterialCountsBuffer = mClRwAllocator.allocateArray<int>(kNumMaterialBuckets * 2);
+        mContextProxy->materialCounts = mMaterialCountsBuffer;
+        mContextProxy->materialOffsets = mMaterialCountsBuffer + kNumMaterialBuckets;
+        mContextProxy->sortedKeys = mClRwAllocator.allocateArray<int>(mNumItems);
+        mTilesBuffer = mClRwAllocator.allocateArray<int>(mNumTileSlots);
+        mContextProxy->tiles = mTilesBuffer;
+        mContextProxy->tileSize = mTileSize;
+        mContextProxy->numTileSlots = mNumTileSlots;
+
+        mClGenerateCameraRaysKernel.setArg(0, mContextProxy);
+        mClIntersectRaysKernel.setArg(0, mContextProxy);
+        mClDirectLightAreaKernel.setArg(0, mContextProxy);
+        mClDirectLightPointKernel.setArg(0, mContextProxy);
+        mClTraceShadowRaysKernel.setArg(0, mContextProxy);
+        mClExtendPathKernel.setArg(0, mContextProxy);
+        mClCommitRadianceKernel.setArg(0, mContextProxy);
+        mClUpdateStatusKernel.setArg(0, mContextProxy);
+        mClToneMapKernel.setArg(0, mContextProxy);
+        mClToneMapKernel.setArg(1, mFramebufferBuffer);
+        mClCountMaterialsKernel.setArg(0, mContextProxy);
+        mClScatterMaterialsKernel.setArg(0, mContextProxy);
+        mClGatherMaterialsKernel.setArg(0, mContextProxy);
+
+        mGenerateCameraRayQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mIntersectRayQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mDirectLightAreaQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mDirectLightPointQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mExtendPathQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mCommitRadianceQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+        mShadowRayQueue = std::make_unique<WorkQueue>(mNumItems, mClRwAllocator);
+
+        mGenerateCameraRayQueue->writeProxy(mContextProxy->generateCameraRayQueue);
+        mIntersectRayQueue->writeProxy(mContextProxy->intersectRaysQueue);
+        mDirectLightAreaQueue->writeProxy(mContextProxy->directLightAreaQueue);
+        mDirectLightPointQueue->writeProxy(mContextProxy->directLightPointQueue);
+        mExtendPathQueue->writeProxy(mContextProxy->extendPathQueue);
+        mCommitRadianceQueue->writeProxy(mContextProxy->commitRadianceQueue);
+        mShadowRayQueue->writeProxy(mContextProxy->shadowRayQueue);
+
+        mClConstAllocator.unmapAreas();
+        mClRwAllocator.unmapAreas();
+    }
+
+    std::vector<std::string> Device::getSourceList()
+    {
+        return std::vector<std::string> {
+            "Math/CLKernels.cl",
+            "Math/Impl/Sampler/CLKernels.cl",
+            "Object/Impl/Albedo/CLKernels.cl",
+            "Object/Impl/Brdf/CLKernels.cl",
+            "Object/Impl/Shape/CLKernels.cl",
+            "Object/CLKernels.cl",
+            "Render/Gpu/CLKernels.cl"
+        };
+    }
+
+    const std::string &Device::name()
+    {
+        return mClContext.deviceName();
+    }
+
+    bool Device::cpuDevice()
+    {
+        return mClContext.cpuDevice();
+    }
+
+    int Device::numItems()
+    {
+        return mNumItems;
+    }
+
+    void Device::reset(int sampleLimit)
+    {
+        clFinish(mClContext.clQueue());
+
+        mClRwAllocator.mapAreas();
+        mContextProxy->currentPixel = 0;
+        mContextProxy->settings.samples = sampleLimit;
+        mSampleLimit = sampleLimit;
+        mNumTiles = 0;
+        std::fill(mHostTiles.begin(), mHostTiles.end(), -1);
+        std::copy(mHostTiles.begin(), mHostTiles.end(), mTilesBuffer);
+
+        mIntersectRayQueue->clear();
+        mDirectLightAreaQueue->clear();
+        mDirectLightPointQueue->clear();
+        mExtendPathQueue->clear();
+        mCommitRadianceQueue->clear();
+        mShadowRayQueue->clear();
+        mGenerateCameraRayQueue->clear();
+        WorkQueue::Key numKeys = static_cast<WorkQueue::Key>(mNumItems);
+        for(WorkQueue::Key key = 0; key < numKeys; key++) {
+            mGenerateCameraRayQueue->addItem(key);
+        }
+        mClRwAllocator.unmapAreas();
+
+        float zeroRadiance = 0;
+        int zeroSamples = 0;
+        clEnqueueSVMMemFill(mClContext.clQueue(), mTotalRadianceBuffer, &zeroRadiance, sizeof(zeroRadiance), mWidth * mHeight * 3 * sizeof(float), 0, NULL, NULL);
+        clEnqueueSVMMemFill(mClContext.clQueue(), mTotalSamplesBuffer, &zeroSamples, sizeof(zeroSamples), mWidth * mHeight * sizeof(int), 0, NULL, NULL);
+    }
+
+    int Device::tilesNeeded(unsigned int currentPixel)
+    {
+        uint64_t target = static_cast<uint64_t>(currentPixel) + kTileLookahead * mNumItems;
+        uint64_t covered = static_cast<uint64_t>(mNumTiles) * mTileSize;
+        if(covered >= target) {
+            return 0;
+        }
+
+        return static_cast<int>((target - covered + mTileSize - 1) / mTileSize);
+    }
+
+    void Device::addTile(int tile)
+    {
+        unsigned int slot = mNumTiles % mNumTileSlots;
+        mNumTiles++;
+        mHostTiles[slot] = tile;
+        clEnqueueSVMMemcpy(mClContext.clQueue(), CL_FALSE, &mTilesBuffer[slot], &mHostTiles[slot], sizeof(int), 0, NULL, NULL);
+    }
+
+    void Device::setSampleLimit(int sampleLimit)
+    {
+        if(sampleLimit < mSampleLimit) {
+            mSampleLimit = sampleLimit;
+            clEnqueueSVMMemcpy(mClContext.clQueue(), CL_FALSE, &mContextProxy->settings.samples, &mSampleLimit, sizeof(mSampleLimit), 0, NULL, NULL);
+        }
+    }
+
+    void Device::enqueueIteration()
+    {
+        mClGenerateCameraRaysKernel.enqueue(mClContext, mLaunchSize);
+        mGenerateCameraRayQueue->enqueueClear(mClContext);
+
+        mClIntersectRaysKernel.enqueue(mClContext, mLaunchSize);
+        mIntersectRayQueue->enqueueClear(mClContext);
+
+        enqueueSortByMaterial(*mDirectLightAreaQueue);
+        mClDirectLightAreaKernel.enqueue(mClContext, mLaunchSize);
+        mDirectLightAreaQueue->enqueueClear(mClContext);
+
+        enqueueSortByMaterial(*mDirectLightPointQueue);
+        mClDirectLightPointKernel.enqueue(mClContext, mLaunchSize);
+        mDirectLightPointQueue->enqueueClear(mClContext);
+
+        mClTraceShadowRaysKernel.enqueue(mClContext, mLaunchSize);
+        mShadowRayQueue->enqueueClear(mClContext);
+
+        enqueueSortByMaterial(*mExtendPathQueue);
+        mClExtendPathKernel.enqueue(mClContext, mLaunchSize);
+        mExtendPathQueue->enqueueClear(mClContext);
+
+        mClCommitRadianceKernel.enqueue(mClContext, mLaunchSize);
+        mCommitRadianceQueue->enqueueClear(mClContext);
+
+        mClUpdateStatusKernel.enqueue(mClContext, 1);
+    }
+
+    void Device::enqueueSortByMaterial(WorkQueue &queue)
+    {
+        WorkQueueProxy queueProxy;
+        queue.writeProxy(queueProxy);
+
+        int zero = 0;
+        clEnqueueSVMMemFill(mClContext.clQueue(), mMaterialCountsBuffer, &zero, sizeof(zero), kNumMaterialBuckets * 2 * sizeof(int), 0, NULL, NULL);
+
+        mClCountMaterialsKernel.setArg(1, queueProxy.data);
+        mClCountMaterialsKernel.enqueue(mClContext, mLaunchSize);
+
+        mClScatterMaterialsKernel.setArg(1, queueProxy.data);
+        mClScatterMaterialsKernel.enqueue(mClContext, mLaunchSize);
+
+        mClGatherMaterialsKernel.setArg(1, queueProxy.data);
+        mClGatherMaterialsKernel.enqueue(mClContext, mLaunchSize);
+    }
+
+    cl_event Device::enqueueReadStatus(StatusProxy &status)
+    {
+        cl_event event;
+        clEnqueueSVMMemcpy(mClContext.clQueue(), CL_FALSE, &status, &mContextProxy->status, sizeof(StatusProxy), 0, NULL, &event);
+        return event;
+    }
+
+    void Device::flush()
+    {
+        clFlush(mClContext.clQueue());
+    }
+
+    void Device::finish()
+    {
+        clFinish(mClContext.clQueue());
+    }
+
+    void Device::readAccumulation(float *radiance, int *samples)
+    {
+        clEnqueueSVMMemcpy(mClContext.clQueue(), CL_TRUE, radiance, mTotalRadianceBuffer, mWidth * mHeight * 3 * sizeof(float), 0, NULL, NULL);
+        clEnqueueSVMMemcpy(mClContext.clQueue(), CL_TRUE, samples, mTotalSamplesBuffer, mWidth * mHeight * sizeof(int), 0, NULL, NULL);
+    }
+
+    void Device::toneMap(unsigned char *bits)
+    {
+        mClToneMapKernel.enqueue(mClContext, mWidth * mHeight);
+        clEnqueueSVMMemcpy(mClContext.clQueue(), CL_TRUE, bits, mFramebufferBuffer, mWidth * mHeight * 3, 0, NULL, NULL);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef RENDER_GPU_DEVICE_HPP
+#define RENDER_GPU_DEVICE_HPP
+
+#include "Object/Scene.hpp"
+
+#include "Render/Gpu/WorkQueue.hpp"
+#include "Render/Gpu/CLProxies.hpp"
+
+#include "OpenCL.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Render::Gpu {
+    class Device {
+    public:
+        Device(const Object::Scene &scene, const std::string &selector, unsigned int width, unsigned int height, int tileSize);
+
+        const std::string &name();
+        bool cpuDevice();
+        int numItems();
+
+        void reset(int sampleLimit);
+        int tilesNeeded(unsigned int currentPixel);
+        void addTile(int tile);
+        void setSampleLimit(int sampleLimit);
+
+        void enqueueIteration();
+        cl_event enqueueReadStatus(StatusProxy &status);
+        void flush();
+        void finish();
+
+        void readAccumulation(float *radiance, int *samples);
+        void toneMap(unsigned char *bits);
+
+    private:
+        static std::vector<std::string> getSourceList();
+
+        void enqueueSortByMaterial(WorkQueue &queue);
+
+        unsigned int mWidth;
+        unsigned int mHeight;
+
+        std::unique_ptr<WorkQueue> mGenerateCameraRayQueue;
+        std::unique_ptr<WorkQueue> mIntersectRayQueue;
+        std::unique_ptr<WorkQueue> mDirectLightAreaQueue;
+        std::unique_ptr<WorkQueue> mDirectLightPointQueue;
+        std::unique_ptr<WorkQueue> mExtendPathQueue;
+        std::unique_ptr<WorkQueue> mCommitRadianceQueue;
+        std::unique_ptr<WorkQueue> mShadowRayQueue;
+
+        OpenCL::Context mClContext;
+        OpenCL::Allocator mClConstAllocator;
+        OpenCL::Allocator mClRwAllocator;
+        OpenCL::Program mClProgram;
+
+        OpenCL::Kernel mClGenerateCameraRaysKernel;
+        OpenCL::Kernel mClIntersectRaysKernel;
+        OpenCL::Kernel mClDirectLightAreaKernel;
+        OpenCL::Kernel mClDirectLightPointKernel;
+        OpenCL::Kernel mClTraceShadowRaysKernel;
+        OpenCL::Kernel mClExtendPathKernel;
+        OpenCL::Kernel mClCommitRadianceKernel;
+        OpenCL::Kernel mClUpdateStatusKernel;
+        OpenCL::Kernel mClToneMapKernel;
+        OpenCL::Kernel mClCountMaterialsKernel;
+        OpenCL::Kernel mClScatterMaterialsKernel;
+        OpenCL::Kernel mClGatherMaterialsKernel;
+
+        ContextProxy *mContextProxy;
+        float *mTotalRadianceBuffer;
+        int *mTotalSamplesBuffer;
+        unsigned char *mFramebufferBuffer;
+        int *mMaterialCountsBuffer;
+        int *mTilesBuffer;
+        std::vector<int> mHostTiles;
+        int mNumItems;
+        int mTileSize;
+        int mNumTileSlots;
+        unsigned int mNumTiles;
+        int mLaunchSize;
+        int mSampleLimit;
+    };
+}
+#endif
@@ -1,70 +1,88 @@
 #include "Render/Gpu/Renderer.hpp"
 
-#include "Render/Gpu/WorkQueue.hpp"
-#include "Render/Gpu/CLProxies.hpp"
-
 #include "Math/Impl/Sampler/Halton.hpp"
 
 #include <memory>
-
-using namespace std::placeholders;
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <functional>
 
 namespace Render::Gpu {
-    static const int kSize = 1000000;
+    static const int kTileSize = 16384;
+
+    struct CpuThreadLocal : public Cpu::Executor::Job::ThreadLocal {
+        Math::Impl::Sampler::Halton sampler;
+        std::vector<Math::Radiance> radiance;
+
+        CpuThreadLocal(int width, int height) : sampler(width, height), radiance(kTileSize) {}
+    };
+
+    class CpuTileJob : public Cpu::Executor::Job {
+    public:
+        typedef std::function<bool(CpuThreadLocal&)> ExecuteFunc;
+        typedef std::function<std::unique_ptr<CpuThreadLocal>()> CreateThreadLocalFunc;
+
+        CpuTileJob(CreateThreadLocalFunc createThreadLocalFunc, ExecuteFunc executeFunc)
+        : mCreateThreadLocalFunc(std::move(createThreadLocalFunc))
+        , mExecuteFunc(std::move(executeFunc))
+        {
+        }
+
+        std::unique_ptr<Cpu::Executor::Job::ThreadLocal> createThreadLocal() override
+        {
+            return mCreateThreadLocalFunc();
+        }
+
+        bool execute(Cpu::Executor::Job::ThreadLocal &threadLocal) override
+        {
+            return mExecuteFunc(static_cast<CpuThreadLocal&>(threadLocal));
+        }
+
+        void done() override
+        {
+        }
+
+    private:
+        CreateThreadLocalFunc mCreateThreadLocalFunc;
+        ExecuteFunc mExecuteFunc;
+    };
 
     Renderer::Renderer(const Object::Scene &scene, const Settings &settings)
     : mScene(scene)
     , mSettings(settings)
-    , mTotalRadiance(settings.width, settings.height)
+    , mMeanRadiance(settings.width, settings.height)
     , mTotalSamples(settings.width, settings.height)
-    , mClConstAllocator(mClContext)
-    , mClRwAllocator(mClContext)
-    , mClProgram(mClContext, getSourceList())
-    , mClGenerateCameraRaysKernel(mClProgram, "generateCameraRays", mClConstAllocator, mClRwAllocator)
-    , mClIntersectRaysKernel(mClProgram, "intersectRays", mClConstAllocator, mClRwAllocator)
-    , mClDirectLightAreaKernel(mClProgram, "directLightArea", mClConstAllocator, mClRwAllocator)
-    , mClDirectLightPointKernel(mClProgram, "directLightPoint", mClConstAllocator, mClRwAllocator)
-    , mClExtendPathKernel(mClProgram, "extendPath", mClConstAllocator, mClRwAllocator)
+    , mHostTotalRadiance(settings.width * settings.height * 3)
+    , mHostTotalSamples(settings.width * settings.height)
     {
         mRunning = false;
+        mActiveThreads = 0;
+        mRunningWorkers = 0;
 
-        mClRwAllocator.mapAreas();
-        mClConstAllocator.mapAreas();
-        mContextProxy = mClRwAllocator.allocate<ContextProxy>();
-
-        scene.writeProxy(mContextProxy->scene, mClConstAllocator);;
-        mContextProxy->settings.width = mSettings.width;
-        mContextProxy->settings.height = mSettings.height;
-        mContextProxy->settings.samples = mSettings.samples;
+        bool cpuDevice = false;
+        for(const std::string &selector : deviceSelectors(mSettings.device)) {
+            mDevices.push_back(std::make_unique<Device>(scene, selector, mSettings.width, mSettings.height, kTileSize));
+            cpuDevice = cpuDevice || mDevices.back()->cpuDevice();
+        }
 
-        Math::Impl::Sampler::Halton sampler(mSettings.width, mSettings.height);
-        sampler.writeProxy(mContextProxy->sampler, mClConstAllocator);
-        mContextProxy->items = mClRwAllocator.allocateArray<ItemProxy>(kSize);
+        if(mSettings.hybrid) {
+            if(cpuDevice) {
+                mWarnings.push_back("Hybrid rendering disabled: an OpenCL CPU device is already in use");
+            } else {
+                mExecutor = std::make_unique<Cpu::Executor>();
+                mCpuTotalRadiance.resize(mHostTotalRadiance.size());
+                mCpuTotalSamples.resize(mHostTotalSamples.size());
+            }
+        }
 
-        mClGenerateCameraRaysKernel.setArg(0, mContextProxy);
-        mClIntersectRaysKernel.setArg(0, mContextProxy);
-        mClDirectLightAreaKernel.setArg(0, mContextProxy);
-        mClDirectLightPointKernel.setArg(0, mContextProxy);
-        mClExtendPathKernel.setArg(0, mContextProxy);
+        if(mDevices.size() > 1 || mExecutor) {
+            mDeviceTotalRadiance.resize(mHostTotalRadiance.size());
+            mDeviceTotalSamples.resize(mHostTotalSamples.size());
+        }
 
         mRenderFramebuffer = std::make_unique<Render::Framebuffer>(settings.width, settings.height);
-                    
-        mGenerateCameraRayQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-        mIntersectRayQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-        mDirectLightAreaQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-        mDirectLightPointQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-        mExtendPathQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-        mCommitRadianceQueue = std::make_unique<Render::Gpu::WorkQueue>(kSize, mClRwAllocator);
-    
-        mGenerateCameraRayQueue->writeProxy(mContextProxy->generateCameraRayQueue);
-        mIntersectRayQueue->writeProxy(mContextProxy->intersectRaysQueue);
-        mDirectLightAreaQueue->writeProxy(mContextProxy->directLightAreaQueue);
-        mDirectLightPointQueue->writeProxy(mContextProxy->directLightPointQueue);
-        mExtendPathQueue->writeProxy(mContextProxy->extendPathQueue);
-        mCommitRadianceQueue->writeProxy(mContextProxy->commitRadianceQueue);
-    
-        mClConstAllocator.unmapAreas();
-        mClRwAllocator.unmapAreas();
     }
 
     Renderer::~Renderer()
@@ -72,44 +90,89 @@ namespace Render::Gpu {
         stop();
     }
 
-    std::vector<std::string> Renderer::getSourceList()
+    std::vector<std::string> Renderer::deviceSelectors(const std::string &device)
     {
-        return std::vector<std::string> {
-            "Math/CLKernels.cl",
-            "Math/Sampler/CLKernels.cl",
-            "Object/Albedo/CLKernels.cl",
-            "Object/Brdf/CLKernels.cl",
-            "Object/Shape/CLKernels.cl",
-            "Object/CLKernels.cl",
-            "Render/Gpu/CLKernels.cl"
-        };
+        std::vector<std::string> selectors;
+
+        if(device == "all") {
+            std::vector<OpenCL::Device> devices = OpenCL::Context::devices();
+            for(unsigned int i = 0; i < devices.size(); i++) {
+                if(devices[i].svm) {
+                    selectors.push_back(std::to_string(i));
+                }
+            }
+        } else {
+            size_t start = 0;
+            while(start <= device.size()) {
+                size_t end = std::min(device.find(',', start), device.size());
+                std::string selector = device.substr(start, end - start);
+                selector.erase(0, selector.find_first_not_of(' '));
+                selector.erase(selector.find_last_not_of(' ') + 1);
+                if(!selector.empty()) {
+                    selectors.push_back(selector);
+                }
+                start = end + 1;
+            }
+        }
+
+        if(selectors.empty()) {
+            selectors.push_back("");
+        }
+
+        return selectors;
     }
 
     void Renderer::start(Listener *listener)
     {
+        for(std::thread &thread : mThreads) {
+            thread.join();
+        }
+        mThreads.clear();
+
         mListener = listener;
         mRunning = true;
         mStartTime = std::chrono::steady_clock::now();
+        Stats::reset();
+
+        mSampleLimit = (mSettings.timeBudget > 0 && mSettings.samples == 0) ? INT_MAX : mSettings.samples;
+        uint64_t numPixels = static_cast<uint64_t>(mSettings.width) * mSettings.height * mSampleLimit;
+        mNumTiles = static_cast<unsigned int>(std::min<uint64_t>((numPixels + kTileSize - 1) / kTileSize, UINT_MAX / kTileSize));
+        mNextTile = 0;
 
-        mClRwAllocator.mapAreas();
-        mContextProxy->currentPixel = 0;
-        for(WorkQueue::Key key = 0; key < kSize; key++) {
-            mGenerateCameraRayQueue->addItem(key);
+        for(std::unique_ptr<Device> &device : mDevices) {
+            device->reset(mSampleLimit);
         }
-        mClRwAllocator.unmapAreas();
 
-        if(mThread.joinable()) {
-            mThread.join();
+        mActiveThreads = static_cast<int>(mDevices.size()) + (mExecutor ? 1 : 0);
+        {
+            std::lock_guard<std::mutex> lock(mDoneMutex);
+            mRunningWorkers = mActiveThreads;
+        }
+        for(std::unique_ptr<Device> &device : mDevices) {
+            Device *devicePtr = device.get();
+            mThreads.emplace_back([this, devicePtr]() { runThread(*devicePtr); });
+        }
+
+        if(mExecutor) {
+            std::fill(mCpuTotalRadiance.begin(), mCpuTotalRadiance.end(), 0.0f);
+            std::fill(mCpuTotalSamples.begin(), mCpuTotalSamples.end(), 0);
+            mExecutor->runJob(std::make_unique<CpuTileJob>(
+                [&]() { return std::make_unique<CpuThreadLocal>(mSettings.width, mSettings.height); },
+                [&](CpuThreadLocal &threadLocal) { return renderCpuTile(threadLocal.sampler, threadLocal.radiance); }
+            ), [&]() { threadDone(); });
         }
-        mThread = std::thread([&]() { runThread(); });
     }
 
     void Renderer::stop()
     {
         mRunning = false;
-        if(mThread.joinable()) {
-            mThread.join();
+        for(std::thread &thread : mThreads) {
+            thread.join();
         }
+        mThreads.clear();
+
+        std::unique_lock<std::mutex> lock(mDoneMutex);
+        mDoneCondVar.wait(lock, [&]() { return mRunningWorkers == 0; });
     }
 
     bool Renderer::running()
@@ -117,98 +180,229 @@ namespace Render::Gpu {
         return mRunning;
     }
 
+    std::vector<std::string> Renderer::warnings()
+    {
+        return mWarnings;
+    }
+
     Render::Framebuffer &Renderer::renderFramebuffer()
     {
         return *mRenderFramebuffer;
     }
 
-    static Math::Color toneMap(const Math::Radiance &radiance)
+    void Renderer::updateFramebuffer()
     {
-        float red = radiance.red() / (radiance.red() + 1);
-        float green = radiance.green() / (radiance.green() + 1);
-        float blue = radiance.blue() / (radiance.blue() + 1);
+        if(mDevices.size() == 1 && !mExecutor) {
+            std::lock_guard<std::mutex> lock(mFramebufferMutex);
+            mDevices[0]->toneMap(mRenderFramebuffer->bits());
+            return;
+        }
 
-        return Math::Color(red, green, blue);
+        readRadiance();
+
+        std::lock_guard<std::mutex> lock(mFramebufferMutex);
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                mRenderFramebuffer->setPixel(x, y, Framebuffer::toneMap(mMeanRadiance.get(x, y)));
+            }
+        }
     }
 
-    void Renderer::runThread()
+    void Renderer::updateRadiance()
     {
-        while(mRunning) {
-            mClRwAllocator.mapAreas();
-            int kernelSize = mGenerateCameraRayQueue->numQueued();
-            if(kernelSize > 0) {
-                mClRwAllocator.unmapAreas();
-                mClGenerateCameraRaysKernel.enqueue(mClContext, kernelSize);
-                clFinish(mClContext.clQueue());
-                mClRwAllocator.mapAreas();
-                mGenerateCameraRayQueue->clear();
-            }
+        readRadiance();
+    }
+
+    Math::Radiance Renderer::radiance(unsigned int x, unsigned int y)
+    {
+        return mMeanRadiance.get(x, y);
+    }
 
-            kernelSize = mIntersectRayQueue->numQueued();
-            if(kernelSize > 0) {
-                mClRwAllocator.unmapAreas();
-                mClIntersectRaysKernel.enqueue(mClContext, kernelSize);
-                clFinish(mClContext.clQueue());
-                mClRwAllocator.mapAreas();
-                mIntersectRayQueue->clear();
+    int Renderer::claimTile()
+    {
+        std::lock_guard<std::mutex> lock(mTileMutex);
+
+        uint64_t limit = static_cast<uint64_t>(mSettings.width) * mSettings.height * mSampleLimit;
+        if(mNextTile >= mNumTiles || static_cast<uint64_t>(mNextTile) * kTileSize >= limit) {
+            return -1;
+        }
+
+        return static_cast<int>(mNextTile++);
+    }
+
+    void Renderer::readRadiance()
+    {
+        std::lock_guard<std::mutex> lock(mFramebufferMutex);
+
+        mDevices[0]->readAccumulation(&mHostTotalRadiance[0], &mHostTotalSamples[0]);
+        for(unsigned int i = 1; i < mDevices.size(); i++) {
+            mDevices[i]->readAccumulation(&mDeviceTotalRadiance[0], &mDeviceTotalSamples[0]);
+            for(size_t j = 0; j < mHostTotalRadiance.size(); j++) {
+                mHostTotalRadiance[j] += mDeviceTotalRadiance[j];
+            }
+            for(size_t j = 0; j < mHostTotalSamples.size(); j++) {
+                mHostTotalSamples[j] += mDeviceTotalSamples[j];
             }
+        }
 
-            kernelSize = mDirectLightAreaQueue->numQueued();                
-            if(kernelSize > 0) {
-                mClRwAllocator.unmapAreas();
-                mClDirectLightAreaKernel.enqueue(mClContext, kernelSize);
-                clFinish(mClContext.clQueue());
-                mClRwAllocator.mapAreas();
-                mDirectLightAreaQueue->clear();
+        if(mExecutor) {
+            std::lock_guard<std::mutex> cpuLock(mCpuMutex);
+            for(size_t j = 0; j < mHostTotalRadiance.size(); j++) {
+                mHostTotalRadiance[j] += mCpuTotalRadiance[j];
+            }
+            for(size_t j = 0; j < mHostTotalSamples.size(); j++) {
+                mHostTotalSamples[j] += mCpuTotalSamples[j];
             }
+        }
 
-            kernelSize = mDirectLightPointQueue->numQueued();
-            if(kernelSize > 0) {
-                mClRwAllocator.unmapAreas();
-                mClDirectLightPointKernel.enqueue(mClContext, kernelSize);
-                clFinish(mClContext.clQueue());
-                mClRwAllocator.mapAreas();
-                mDirectLightPointQueue->clear();
+        for(unsigned int y = 0; y < mSettings.height; y++) {
+            for(unsigned int x = 0; x < mSettings.width; x++) {
+                unsigned int pixel = y * mSettings.width + x;
+                int numSamples = mHostTotalSamples[pixel];
+                mTotalSamples.set(x, y, numSamples);
+                if(numSamples > 0) {
+                    Math::Radiance radTotal(mHostTotalRadiance[pixel * 3 + 0], mHostTotalRadiance[pixel * 3 + 1], mHostTotalRadiance[pixel * 3 + 2]);
+                    mMeanRadiance.set(x, y, radTotal / static_cast<float>(numSamples));
+                }
             }
+        }
+    }
+
+    void Renderer::runThread(Device &device)
+    {
+        StatusProxy status[2];
+        cl_event statusEvents[2] = { NULL, NULL };
+        unsigned int currentPixel = 0;
+        bool done = false;
+
+        for(unsigned int iteration = 0; mRunning && !done; iteration++) {
+            int current = iteration % 2;
+            int previous = 1 - current;
 
-            kernelSize = mExtendPathQueue->numQueued();
-            if(kernelSize > 0) {
-                mClRwAllocator.unmapAreas();
-                mClExtendPathKernel.enqueue(mClContext, kernelSize);
-                clFinish(mClContext.clQueue());
-                mClRwAllocator.mapAreas();
-                mExtendPathQueue->clear();
+            for(int i = device.tilesNeeded(currentPixel); i > 0; i--) {
+                device.addTile(claimTile());
             }
 
-            int numQueued = mCommitRadianceQueue->numQueued();
-            for(int i=0; i<numQueued; i++) {
-                WorkQueue::Key key = mCommitRadianceQueue->getNextKey();
-                ItemProxy &item = mContextProxy->items[key];
+            device.enqueueIteration();
+            statusEvents[current] = device.enqueueReadStatus(status[current]);
+            device.flush();
 
-                Math::Radiance radTotal = mTotalRadiance.get(item.x, item.y) + Math::Radiance(item.radiance);
-                mTotalRadiance.set(item.x, item.y, radTotal);
+            if(!statusEvents[previous]) {
+                continue;
+            }
 
-                int numSamples = mTotalSamples.get(item.x, item.y) + 1;
-                Math::Color color = toneMap(radTotal / static_cast<float>(numSamples));
-                mRenderFramebuffer->setPixel(item.x, item.y, color);
+            clWaitForEvents(1, &statusEvents[previous]);
+            clReleaseEvent(statusEvents[previous]);
+            statusEvents[previous] = NULL;
+            currentPixel = status[previous].currentPixel;
+
+            int sampleLimit;
+            {
+                std::lock_guard<std::mutex> lock(mTileMutex);
+                if(mSettings.timeBudget > 0) {
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - mStartTime;
+                    if(elapsed.count() >= mSettings.timeBudget) {
+                        int currentSample = static_cast<int>(static_cast<uint64_t>(mNextTile) * kTileSize / (mSettings.width * mSettings.height));
+                        if(currentSample + 1 < mSampleLimit) {
+                            mSampleLimit = currentSample + 1;
+                        }
+                    }
+                }
+                sampleLimit = mSampleLimit;
+            }
+            device.setSampleLimit(sampleLimit);
 
-                mTotalSamples.set(item.x, item.y, numSamples);
+            if(status[previous].numRays == 0) {
+                done = true;
+            }
+        }
 
-                mGenerateCameraRayQueue->addItem(key);
+        device.finish();
+        for(cl_event event : statusEvents) {
+            if(event) {
+                clReleaseEvent(event);
             }
-            mCommitRadianceQueue->clear();
+        }
 
-            int numRays = mGenerateCameraRayQueue->numQueued() + mIntersectRayQueue->numQueued();
-            mClRwAllocator.unmapAreas();
+        threadDone();
+    }
+
+    void Renderer::threadDone()
+    {
+        if(--mActiveThreads == 0) {
+            readRadiance();
 
-            if(numRays == 0) {
+            if(mRunning) {
                 auto endTime = std::chrono::steady_clock::now();
                 std::chrono::duration<double> duration = endTime - mStartTime;
-                mListener->onRendererDone(duration.count()); 
+                uint64_t totalSamples = 0;
+                for(unsigned int y = 0; y < mSettings.height; y++) {
+                    for(unsigned int x = 0; x < mSettings.width; x++) {
+                        totalSamples += mTotalSamples.get(x, y);
+                    }
+                }
+                mListener->onRendererDone(duration.count(), static_cast<float>(totalSamples) / (mSettings.width * mSettings.height));
                 mRunning = false;
-                break;
             }
+        }
+
+        std::lock_guard<std::mutex> lock(mDoneMutex);
+        mRunningWorkers--;
+        mDoneCondVar.notify_all();
+    }
+
+    bool Renderer::renderCpuTile(Math::Sampler &sampler, std::vector<Math::Radiance> &radiance)
+    {
+        if(!mRunning) {
+            return false;
+        }
+
+        int tile = claimTile();
+        if(tile < 0) {
+            return false;
+        }
+
+        uint64_t numPixels = static_cast<uint64_t>(mSettings.width) * mSettings.height;
+        uint64_t start = static_cast<uint64_t>(tile) * kTileSize;
+        uint64_t end = std::min(start + kTileSize, numPixels * mSampleLimit);
+        uint64_t index;
+        for(index = start; index < end && mRunning; index++) {
+            unsigned int pixel = static_cast<unsigned int>(index % numPixels);
+            int sample = static_cast<int>(index / numPixels);
+            radiance[index - start] = renderCpuSample(pixel % mSettings.width, pixel / mSettings.width, sample, sampler);
+        }
+
+        std::lock_guard<std::mutex> lock(mCpuMutex);
+        for(uint64_t i = start; i < index; i++) {
+            unsigned int pixel = static_cast<unsigned int>(i % numPixels);
+            const Math::Radiance &rad = radiance[i - start];
+            mCpuTotalRadiance[pixel * 3 + 0] += rad.red();
+            mCpuTotalRadiance[pixel * 3 + 1] += rad.green();
+            mCpuTotalRadiance[pixel * 3 + 2] += rad.blue();
+            mCpuTotalSamples[pixel]++;
+        }
+
+        return true;
+    }
+
+    Math::Radiance Renderer::renderCpuSample(unsigned int x, unsigned int y, int sample, Math::Sampler &sampler)
+    {
+        Stats::count(Stats::Counter::PrimaryRays);
+        sampler.startSample(x, y, sample);
+        Math::Point2D imagePoint = Math::Point2D((float)x, (float)y) + sampler.getValue2D();
+        Math::Point2D aperturePoint = sampler.getValue2D();
+        Math::Beam beam = mScene.camera().createPixelBeam(imagePoint, mSettings.width, mSettings.height, aperturePoint);
+        Object::Intersection isect = mScene.intersect(beam, FLT_MAX, true);
+
+        Math::Radiance rad;
+        if(isect.valid()) {
+            rad = mCpuLighter.light(isect, sampler);
+        } else {
+            for(const Object::Light &light : mScene.skyLights()) {
+                rad += light.radiance(beam.ray().direction());
+            }
+        }
 
-        }    
+        return rad;
     }
-}
\ No newline at end of file
+}
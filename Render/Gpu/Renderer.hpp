@@ -7,14 +7,17 @@
 
 #include "Render/Framebuffer.hpp"
 #include "Render/Raster.hpp"
-#include "Render/Gpu/WorkQueue.hpp"
+#include "Render/Gpu/Device.hpp"
+#include "Render/Cpu/Executor.hpp"
+#include "Render/Cpu/Impl/Lighter/UniPath.hpp"
 
-#include "Math/Beam.hpp"
-
-#include "OpenCL.hpp"
-
-#include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace Render::Gpu {
     class Renderer : public Render::Renderer {
@@ -24,6 +27,9 @@ namespace Render::Gpu {
             unsigned int width;
             unsigned int height;
             unsigned int samples;
+            float timeBudget;
+            std::string device;
+            bool hybrid;
         };
 
         Renderer(const Object::Scene &scene, const Settings &settings);
@@ -32,47 +38,57 @@ namespace Render::Gpu {
         void start(Listener *listener) override;
         void stop() override;
         bool running() override;
+        std::vector<std::string> warnings() override;
 
         Render::Framebuffer &renderFramebuffer() override;
+        void updateFramebuffer() override;
+        void updateRadiance() override;
+        Math::Radiance radiance(unsigned int x, unsigned int y) override;
 
     private:
-        std::vector<std::string> getSourceList();
+        static std::vector<std::string> deviceSelectors(const std::string &device);
 
-        void runThread();
+        void runThread(Device &device);
+        void threadDone();
+        int claimTile();
+        bool renderCpuTile(Math::Sampler &sampler, std::vector<Math::Radiance> &radiance);
+        Math::Radiance renderCpuSample(unsigned int x, unsigned int y, int sample, Math::Sampler &sampler);
+        void readRadiance();
 
-        bool mRunning;
+        std::atomic<bool> mRunning;
         Listener *mListener;
         std::chrono::time_point<std::chrono::steady_clock> mStartTime;
 
         const Object::Scene &mScene;
         const Settings mSettings;
+        std::vector<std::string> mWarnings;
         std::unique_ptr<Render::Framebuffer> mRenderFramebuffer;
 
-        std::unique_ptr<WorkQueue> mGenerateCameraRayQueue;            
-        std::unique_ptr<WorkQueue> mIntersectRayQueue;            
-        std::unique_ptr<WorkQueue> mDirectLightAreaQueue;
-        std::unique_ptr<WorkQueue> mDirectLightPointQueue;
-        std::unique_ptr<WorkQueue> mExtendPathQueue;
-        std::unique_ptr<WorkQueue> mCommitRadianceQueue;
+        std::vector<std::unique_ptr<Device>> mDevices;
+        std::vector<std::thread> mThreads;
+        std::atomic<int> mActiveThreads;
+        std::mutex mDoneMutex;
+        std::condition_variable mDoneCondVar;
+        int mRunningWorkers;
 
-        std::thread mThread;
+        std::unique_ptr<Cpu::Executor> mExecutor;
+        Cpu::Impl::Lighter::UniPath mCpuLighter;
+        std::mutex mCpuMutex;
+        std::vector<float> mCpuTotalRadiance;
+        std::vector<int> mCpuTotalSamples;
+
+        std::mutex mTileMutex;
+        unsigned int mNextTile;
+        unsigned int mNumTiles;
+        std::atomic<int> mSampleLimit;
 
         std::mutex mFramebufferMutex;
-        Raster<Math::Radiance> mTotalRadiance;
+        Raster<Math::Radiance, HalfRadianceStorage> mMeanRadiance;
         Raster<int> mTotalSamples;
-
-        OpenCL::Context mClContext;
-        OpenCL::Allocator mClConstAllocator;
-        OpenCL::Allocator mClRwAllocator;
-        OpenCL::Program mClProgram;
-
-        OpenCL::Kernel mClGenerateCameraRaysKernel;
-        OpenCL::Kernel mClIntersectRaysKernel;
-        OpenCL::Kernel mClDirectLightAreaKernel;
-        OpenCL::Kernel mClDirectLightPointKernel;
-        OpenCL::Kernel mClExtendPathKernel;
-
-        ContextProxy *mContextProxy;
+        std::vector<float> mHostTotalRadiance;
+        std::vector<int> mHostTotalSamples;
+        std::vector<float> mDeviceTotalRadiance;
+        std::vector<int> mDeviceTotalSamples;
     };
 }
 #endif
\ No newline at end of file
@@ -45,6 +45,12 @@ namespace Render::Gpu {
         mData[1] = 0;
     }
 
+    void WorkQueue::enqueueClear(OpenCL::Context &context)
+    {
+        Key zero = 0;
+        clEnqueueSVMMemFill(context.clQueue(), mData, &zero, sizeof(zero), 2 * sizeof(Key), 0, NULL, NULL);
+    }
+
     void WorkQueue::writeProxy(WorkQueueProxy &proxy) const
     {
         proxy.data = (int*)mData;
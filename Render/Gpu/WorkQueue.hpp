@@ -22,6 +22,7 @@ namespace Render::Gpu {
         int numQueued();
         void resetRead();
         void clear();
+        void enqueueClear(OpenCL::Context &context);
 
         void writeProxy(WorkQueueProxy &proxy) const;
 
@@ -0,0 +1,34 @@
+#include "Render/PfmFile.hpp"
+
+#include <fstream>
+#include <vector>
+
+namespace Render {
+    bool PfmFile::save(const std::string &filename, Renderer &renderer)
+    {
+        std::ofstream file(filename.c_str(), std::ios_base::binary);
+        if(!file) {
+            return false;
+        }
+
+        renderer.updateRadiance();
+
+        unsigned int width = renderer.renderFramebuffer().width();
+        unsigned int height = renderer.renderFramebuffer().height();
+        file << "PF\n" << width << " " << height << "\n-1.0\n";
+
+        std::vector<float> scanline(width * 3);
+        for(unsigned int i = 0; i < height; i++) {
+            unsigned int y = height - 1 - i;
+            for(unsigned int x = 0; x < width; x++) {
+                Math::Radiance radiance = renderer.radiance(x, y);
+                scanline[x * 3 + 0] = radiance.red();
+                scanline[x * 3 + 1] = radiance.green();
+                scanline[x * 3 + 2] = radiance.blue();
+            }
+            file.write((const char*)&scanline[0], scanline.size() * sizeof(float));
+        }
+
+        return file.good();
+    }
+}
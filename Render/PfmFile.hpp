@@ -0,0 +1,15 @@
+#ifndef RENDER_PFM_FILE_HPP
+#define RENDER_PFM_FILE_HPP
+
+#include "Render/Renderer.hpp"
+
+#include <string>
+
+namespace Render {
+    class PfmFile
+    {
+    public:
+        static bool save(const std::string &filename, Renderer &renderer);
+    };
+}
+#endif
@@ -1,30 +1,30 @@
 #ifndef RENDER_RASTER_HPP
 #define RENDER_RASTER_HPP
 
-#include <vector>
+#include "Render/RasterStorage.hpp"
 
 namespace Render {
-    template <typename T>
+    template <typename T, typename Storage = VectorStorage<T>>
     class Raster {
     public:
         Raster(unsigned int width, unsigned int height)
         {
             mWidth = width;
             mHeight = height;
-            mElements.resize(mWidth * mHeight);
+            mStorage.resize(mWidth * mHeight);
         }
 
         unsigned int width() const { return mWidth; }
         unsigned int height() const { return mHeight; }
 
-        void set(unsigned int x, unsigned int y, const T &value) { mElements[mWidth * y + x] = value; }
-        const T &get(unsigned int x, unsigned int y) const { return mElements.at(mWidth * y + x); }
-        T &at(unsigned int x, unsigned int y) { return mElements.at(mWidth * y + x); }
+        void set(unsigned int x, unsigned int y, const T &value) { mStorage.set(mWidth * y + x, value); }
+        decltype(auto) get(unsigned int x, unsigned int y) const { return mStorage.get(mWidth * y + x); }
+        T &at(unsigned int x, unsigned int y) { return mStorage.at(mWidth * y + x); }
 
     private:
         unsigned int mWidth;
         unsigned int mHeight;
-        std::vector<T> mElements;
+        Storage mStorage;
     };
 }
 #endif
@@ -0,0 +1,86 @@
+#include "Render/RasterStorage.hpp"
+
+#include <cstring>
+
+namespace Render {
+    static uint32_t floatBits(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static float bitsFloat(uint32_t bits)
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    static uint16_t floatToHalf(float value)
+    {
+        const uint32_t f32Infinity = 255 << 23;
+        const uint32_t f16Max = (127 + 16) << 23;
+        const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+        uint32_t bits = floatBits(value);
+        uint32_t sign = bits & 0x80000000;
+        bits ^= sign;
+
+        uint16_t half;
+        if(bits >= f16Max) {
+            if(bits > f32Infinity) {
+                half = 0x7e00;
+            } else if(bits == f32Infinity) {
+                half = 0x7c00;
+            } else {
+                half = 0x7bff;
+            }
+        } else if(bits < (113 << 23)) {
+            half = (uint16_t)(floatBits(bitsFloat(bits) + bitsFloat(denormMagic)) - denormMagic);
+        } else {
+            uint32_t mantissaOdd = (bits >> 13) & 1;
+            bits += ((uint32_t)(15 - 127) << 23) + 0xfff;
+            bits += mantissaOdd;
+            half = (uint16_t)(bits >> 13);
+        }
+
+        return half | (uint16_t)(sign >> 16);
+    }
+
+    static float halfToFloat(uint16_t half)
+    {
+        const uint32_t magic = 113 << 23;
+        const uint32_t shiftedExponent = 0x7c00 << 13;
+
+        uint32_t bits = (half & 0x7fff) << 13;
+        uint32_t exponent = shiftedExponent & bits;
+        bits += (127 - 15) << 23;
+
+        if(exponent == shiftedExponent) {
+            bits += (128 - 16) << 23;
+        } else if(exponent == 0) {
+            bits += 1 << 23;
+            bits = floatBits(bitsFloat(bits) - bitsFloat(magic));
+        }
+
+        return bitsFloat(bits | ((uint32_t)(half & 0x8000) << 16));
+    }
+
+    void HalfRadianceStorage::resize(size_t size)
+    {
+        mChannels.resize(size * 3);
+    }
+
+    void HalfRadianceStorage::set(size_t index, const Math::Radiance &value)
+    {
+        mChannels[index * 3 + 0] = floatToHalf(value.red());
+        mChannels[index * 3 + 1] = floatToHalf(value.green());
+        mChannels[index * 3 + 2] = floatToHalf(value.blue());
+    }
+
+    Math::Radiance HalfRadianceStorage::get(size_t index) const
+    {
+        return Math::Radiance(halfToFloat(mChannels[index * 3 + 0]), halfToFloat(mChannels[index * 3 + 1]), halfToFloat(mChannels[index * 3 + 2]));
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef RENDER_RASTER_STORAGE_HPP
+#define RENDER_RASTER_STORAGE_HPP
+
+#include "Math/Radiance.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Render {
+    template <typename T>
+    class VectorStorage {
+    public:
+        void resize(size_t size) { mElements.resize(size); }
+
+        void set(size_t index, const T &value) { mElements[index] = value; }
+        const T &get(size_t index) const { return mElements.at(index); }
+        T &at(size_t index) { return mElements.at(index); }
+
+    private:
+        std::vector<T> mElements;
+    };
+
+    class HalfRadianceStorage {
+    public:
+        void resize(size_t size);
+
+        void set(size_t index, const Math::Radiance &value);
+        Math::Radiance get(size_t index) const;
+
+    private:
+        std::vector<uint16_t> mChannels;
+    };
+}
+#endif
@@ -3,13 +3,20 @@
 
 #include "Render/Framebuffer.hpp"
 
+#include "Math/Radiance.hpp"
+
+#include "Stats.hpp"
+
+#include <string>
+#include <vector>
+
 namespace Render {
     class Renderer {
     public:
         class Listener {
         public:
             virtual ~Listener() = default;
-            virtual void onRendererDone(float totalTimeSeconds) = 0;
+            virtual void onRendererDone(float totalTimeSeconds, float samplesPerPixel) = 0;
         };
 
         virtual ~Renderer() = default;
@@ -19,6 +26,11 @@ namespace Render {
         virtual bool running() = 0;
 
         virtual Render::Framebuffer &renderFramebuffer() = 0;
+        virtual void updateFramebuffer() = 0;
+        virtual void updateRadiance() {}
+        virtual Math::Radiance radiance(unsigned int x, unsigned int y) = 0;
+        virtual Stats::Snapshot stats() { return Stats::snapshot(); }
+        virtual std::vector<std::string> warnings() { return std::vector<std::string>(); }
     };
 }
 
@@ -0,0 +1,47 @@
+#ifndef RENDER_TILED_RASTER_HPP
+#define RENDER_TILED_RASTER_HPP
+
+#include <vector>
+
+namespace Render {
+    template <typename T>
+    class TiledRaster {
+    public:
+        TiledRaster(unsigned int width, unsigned int height)
+        {
+            mWidth = width;
+            mHeight = height;
+            mTilesX = (mWidth + kTileSize - 1) / kTileSize;
+            unsigned int tilesY = (mHeight + kTileSize - 1) / kTileSize;
+            mElements.resize(mTilesX * tilesY * kTileSize * kTileSize);
+        }
+
+        unsigned int width() const { return mWidth; }
+        unsigned int height() const { return mHeight; }
+
+        void set(unsigned int x, unsigned int y, const T &value) { mElements[index(x, y)] = value; }
+        const T &get(unsigned int x, unsigned int y) const { return mElements[index(x, y)]; }
+        T &at(unsigned int x, unsigned int y) { return mElements[index(x, y)]; }
+
+    private:
+        static const unsigned int kTileShift = 3;
+        static const unsigned int kTileSize = 1 << kTileShift;
+        static const unsigned int kTileMask = kTileSize - 1;
+
+        unsigned int index(unsigned int x, unsigned int y) const
+        {
+            unsigned int tile = (y >> kTileShift) * mTilesX + (x >> kTileShift);
+            unsigned int tx = x & kTileMask;
+            unsigned int ty = y & kTileMask;
+            unsigned int morton = (tx & 1) | ((ty & 1) << 1) | ((tx & 2) << 1) | ((ty & 2) << 2) | ((tx & 4) << 2) | ((ty & 4) << 3);
+
+            return (tile << (2 * kTileShift)) | morton;
+        }
+
+        unsigned int mWidth;
+        unsigned int mHeight;
+        unsigned int mTilesX;
+        std::vector<T> mElements;
+    };
+}
+#endif
@@ -0,0 +1,94 @@
+#include "Stats.hpp"
+
+#include <atomic>
+
+namespace Stats {
+    static const char *sCounterNames[kNumCounters] = {
+        "primary_rays",
+        "closest_hit_rays",
+        "any_hit_rays",
+        "bvh_nodes_visited",
+        "primitives_tested",
+        "triangles_tested",
+        "irradiance_cache_hits",
+        "irradiance_cache_misses",
+        "reservoir_rejections"
+    };
+
+    static const char *sTimerNames[kNumTimers] = {
+        "prerender",
+        "sample",
+        "initial_sample",
+        "spatial_reuse",
+        "direct_illuminate",
+        "indirect_illuminate"
+    };
+
+    const char *counterName(Counter counter)
+    {
+        return sCounterNames[static_cast<size_t>(counter)];
+    }
+
+    const char *timerName(Timer timer)
+    {
+        return sTimerNames[static_cast<size_t>(timer)];
+    }
+
+#ifdef ENABLE_STATS
+    thread_local ThreadStats sThreadStats = {};
+
+    static std::atomic<uint64_t> sCounters[kNumCounters];
+    static std::atomic<uint64_t> sTimerNanoseconds[kNumTimers];
+
+    void flush()
+    {
+        for(size_t i = 0; i < kNumCounters; i++) {
+            sCounters[i].fetch_add(sThreadStats.counters[i], std::memory_order_relaxed);
+            sThreadStats.counters[i] = 0;
+        }
+
+        for(size_t i = 0; i < kNumTimers; i++) {
+            sTimerNanoseconds[i].fetch_add(sThreadStats.timerNanoseconds[i], std::memory_order_relaxed);
+            sThreadStats.timerNanoseconds[i] = 0;
+        }
+    }
+
+    void reset()
+    {
+        for(size_t i = 0; i < kNumCounters; i++) {
+            sCounters[i] = 0;
+        }
+
+        for(size_t i = 0; i < kNumTimers; i++) {
+            sTimerNanoseconds[i] = 0;
+        }
+    }
+
+    Snapshot snapshot()
+    {
+        Snapshot snapshot;
+        for(size_t i = 0; i < kNumCounters; i++) {
+            snapshot.counters[i] = sCounters[i].load(std::memory_order_relaxed);
+        }
+
+        for(size_t i = 0; i < kNumTimers; i++) {
+            snapshot.timerSeconds[i] = sTimerNanoseconds[i].load(std::memory_order_relaxed) / 1e9;
+        }
+
+        return snapshot;
+    }
+#else
+    void flush()
+    {
+    }
+
+    void reset()
+    {
+    }
+
+    Snapshot snapshot()
+    {
+        return Snapshot{};
+    }
+#endif
+}
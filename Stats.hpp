@@ -0,0 +1,81 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace Stats {
+    enum class Counter {
+        PrimaryRays,
+        ClosestHitRays,
+        AnyHitRays,
+        BvhNodesVisited,
+        PrimitivesTested,
+        TrianglesTested,
+        IrradianceCacheHits,
+        IrradianceCacheMisses,
+        ReservoirRejections,
+        Count
+    };
+
+    enum class Timer {
+        Prerender,
+        Sample,
+        InitialSample,
+        SpatialReuse,
+        DirectIlluminate,
+        IndirectIlluminate,
+        Count
+    };
+
+    static const size_t kNumCounters = static_cast<size_t>(Counter::Count);
+    static const size_t kNumTimers = static_cast<size_t>(Timer::Count);
+
+    struct Snapshot {
+        uint64_t counters[kNumCounters];
+        double timerSeconds[kNumTimers];
+    };
+
+    const char *counterName(Counter counter);
+    const char *timerName(Timer timer);
+
+    void flush();
+    void reset();
+    Snapshot snapshot();
+
+#ifdef ENABLE_STATS
+    struct ThreadStats {
+        uint64_t counters[kNumCounters];
+        uint64_t timerNanoseconds[kNumTimers];
+    };
+    extern thread_local ThreadStats sThreadStats;
+
+    inline void count(Counter counter, uint64_t value = 1)
+    {
+        sThreadStats.counters[static_cast<size_t>(counter)] += value;
+    }
+
+    class ScopedTimer {
+    public:
+        ScopedTimer(Timer timer) : mTimer(timer), mStart(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer()
+        {
+            std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - mStart;
+            sThreadStats.timerNanoseconds[static_cast<size_t>(mTimer)] += duration.count();
+        }
+
+    private:
+        Timer mTimer;
+        std::chrono::steady_clock::time_point mStart;
+    };
+#else
+    inline void count(Counter, uint64_t = 1) {}
+
+    class ScopedTimer {
+    public:
+        ScopedTimer(Timer) {}
+    };
+#endif
+}
+#endif